@@ -153,7 +153,7 @@ namespace gui {
                 std::string ext4 = len > 4 ? filename.substr(len - 4) : "";
                 for (char& c : ext) c = tolower(c);
                 for (char& c : ext4) c = tolower(c);
-                if (ext == ".gb" || ext4 == ".gbc") {
+                if (ext == ".gb" || ext4 == ".gbc" || ext == ".gz" || ext4 == ".zip") {
                     romList.push_back(std::string(directory) + "/" + filename);
                 }
             }
@@ -1,7 +1,14 @@
 #include "included/apu.hpp"
 #include "included/state.hpp"
+#include "included/memory.hpp"
+#include "included/blip_buffer.hpp"
+#include "included/resampler.hpp"
 #include <cstring>
 
+#if defined(__ARM_FEATURE_SIMD32)
+#include <arm_acle.h>
+#endif
+
 namespace gb {
     namespace apu {
 
@@ -12,15 +19,85 @@ namespace gb {
             0b11111100
         };
 
+        //precomputed noise sequences: the output bit of every lfsr step for
+        //the 15 bit (32767 steps) and 7 bit (127 steps) modes, starting from
+        //0x7FFF, padded past the end so any 32 bit window reads without wrapping,
+        //plus the reverse state -> position maps
+        static uint32_t lfsr15Bits[(LFSR15_PERIOD + 64) / 32 + 1];
+        static uint16_t lfsr15Index[0x8000];
+        static uint32_t lfsr7Bits[(LFSR7_PERIOD + 64) / 32 + 1];
+        static uint8_t lfsr7Index[0x80];
+
+        static inline int sequenceBit(const uint32_t* bits, int index) {
+            return (bits[index >> 5] >> (index & 31)) & 1;
+        }
+
+        //next 32 output bits starting at index
+        static inline uint32_t sequenceWindow(const uint32_t* bits, int index) {
+            uint64_t pair = ((uint64_t)bits[(index >> 5) + 1] << 32) | bits[index >> 5];
+            return (uint32_t)(pair >> (index & 31));
+        }
+
+        void buildLFSRTables() {
+            memset(lfsr15Bits, 0, sizeof(lfsr15Bits));
+            memset(lfsr7Bits, 0, sizeof(lfsr7Bits));
+            memset(lfsr15Index, 0, sizeof(lfsr15Index));
+            memset(lfsr7Index, 0, sizeof(lfsr7Index));
+
+            uint16_t lfsr = 0x7FFF;
+            for (int i = 0; i < LFSR15_PERIOD + 64; i++) {
+                if (i < LFSR15_PERIOD) lfsr15Index[lfsr] = i;
+                lfsr15Bits[i >> 5] |= (uint32_t)(lfsr & 1) << (i & 31);
+                uint16_t bit = (lfsr & 1) ^ ((lfsr >> 1) & 1);
+                lfsr = (lfsr >> 1) | (bit << 14);
+            }
+
+            //the low 7 bits of the width mode lfsr run on their own
+            uint8_t low = 0x7F;
+            for (int i = 0; i < LFSR7_PERIOD + 64; i++) {
+                if (i < LFSR7_PERIOD) lfsr7Index[low] = i;
+                lfsr7Bits[i >> 5] |= (uint32_t)(low & 1) << (i & 31);
+                uint8_t bit = (low & 1) ^ ((low >> 1) & 1);
+                low = (low >> 1) | (bit << 6);
+            }
+        }
+
         void initialize(GBState& state) {
             auto& apu = state.apu;
 
-            memset(apu.audioBuffer, 0, sizeof(apu.audioBuffer));
+            static bool lfsrBuilt = false;
+            if (!lfsrBuilt) {
+                buildLFSRTables();
+                lfsrBuilt = true;
+            }
+
+            memory::registerIORange(state, 0x10, 0x3F, readRegister, writeRegister);
+
+            //the buffers themselves are bound by buffers::initialize / attachAudio
+            if (apu.audioBuffer) {
+                memset(apu.audioBuffer, 0, APUState::BUFFER_SIZE * 2 * sizeof(int16_t));
+            }
             apu.bufferPosition = 0;
+            apu.lastSync = state.scheduler.cycles;
             apu.sampleCycles = 0;
             apu.frameSequencerCycles = 0;
             apu.frameSequencerStep = 0;
 
+            apu.mode = AudioMode::FULL;
+            apu.synthesis = AudioSynthesis::BANDLIMITED;
+            apu.blockMixing = true;
+            apu.blockPosition = 0;
+            apu.frameClocks = 0;
+            for (int i = 0; i < 4; i++) {
+                apu.channelOutput[i] = 0;
+            }
+            apu.mixLeft = 0;
+            apu.mixRight = 0;
+            apu.sampleRate = SAMPLE_RATE;
+            resampler::configure(apu.resampler, SAMPLE_RATE, SAMPLE_RATE);
+            blip::initialize(apu.blipLeft, SAMPLE_RATE);
+            blip::initialize(apu.blipRight, SAMPLE_RATE);
+
             auto& ch1 = apu.ch1;
             ch1.enabled = false;
             ch1.frequency = 0;
@@ -58,6 +135,7 @@ namespace gb {
             ch3.position = 0;
             ch3.volume = 0;
             ch3.lengthCounter = 0;
+            rebuildWaveTable(state);
 
             auto& ch4 = apu.ch4;
             ch4.enabled = false;
@@ -82,26 +160,244 @@ namespace gb {
             apu.ch4Left = apu.ch4Right = true;
         }
 
-        void tick(GBState& state, int cycles) {
+        //current amplitude of each channel, 0 while it is off
+        template <typename Channel>
+        static inline int squareOutput(const Channel& ch) {
+            if (!ch.enabled) return 0;
+            return (dutyPatterns[ch.duty] >> ch.dutyPosition) & 1 ? ch.volume : -ch.volume;
+        }
+
+        static inline int waveOutput(GBState& state) {
+            auto& ch3 = state.apu.ch3;
+            if (!ch3.enabled || !ch3.dacEnabled) return 0;
+            return ch3.waveTable[ch3.position];
+        }
+
+        //nr32 volume code -> right shift of the 4 bit sample
+        static const uint8_t waveShift[4] = { 4, 0, 1, 2 };
+
+        static inline void decodeWaveByte(Channel3State& ch3, int index, uint8_t value) {
+            int shift = waveShift[ch3.volume & 3];
+            ch3.waveTable[index * 2] = (int8_t)((value >> 4) >> shift) - 8;
+            ch3.waveTable[index * 2 + 1] = (int8_t)((value & 0x0F) >> shift) - 8;
+        }
+
+        void rebuildWaveTable(GBState& state) {
+            for (int i = 0; i < 16; i++) {
+                decodeWaveByte(state.apu.ch3, i, state.memory.io[0x30 + i]);
+            }
+        }
+
+        static inline int noiseOutput(const Channel4State& ch4) {
+            if (!ch4.enabled) return 0;
+            return (ch4.lfsr & 1) ? -ch4.volume : ch4.volume;
+        }
+
+        //recompute the stereo mix and hand the change to the blip buffers
+        static void updateMix(GBState& state, uint32_t time) {
             auto& apu = state.apu;
+            const int* out = apu.channelOutput;
+
+            int left = 0;
+            int right = 0;
+            if (apu.ch1Left) left += out[0];
+            if (apu.ch2Left) left += out[1];
+            if (apu.ch3Left) left += out[2];
+            if (apu.ch4Left) left += out[3];
+            if (apu.ch1Right) right += out[0];
+            if (apu.ch2Right) right += out[1];
+            if (apu.ch3Right) right += out[2];
+            if (apu.ch4Right) right += out[3];
+
+            left = left * apu.masterVolumeLeft * 64;
+            right = right * apu.masterVolumeRight * 64;
+
+            if (left != apu.mixLeft) {
+                blip::addDelta(apu.blipLeft, time, left - apu.mixLeft);
+                apu.mixLeft = left;
+            }
+            if (right != apu.mixRight) {
+                blip::addDelta(apu.blipRight, time, right - apu.mixRight);
+                apu.mixRight = right;
+            }
+        }
 
-            if (!apu.masterEnable) {
+        static inline void setChannelOutput(GBState& state, int channel, int amplitude, uint32_t time) {
+            if (state.apu.channelOutput[channel] == amplitude) return;
+            state.apu.channelOutput[channel] = amplitude;
+            updateMix(state, time);
+        }
+
+        //point sampled frames at the native rate into the audio buffer,
+        //through the resampler when the output rate differs
+        static void outputFrames(GBState& state, const int16_t* frames, int count) {
+            auto& apu = state.apu;
+            int space = APUState::BUFFER_SIZE - apu.bufferPosition;
+            int16_t* out = &apu.audioBuffer[apu.bufferPosition * 2];
+
+            if (apu.sampleRate != SAMPLE_RATE) {
+                apu.bufferPosition += resampler::process(apu.resampler, frames, count, out, space);
                 return;
             }
 
-            apu.frameSequencerCycles += cycles;
-            while (apu.frameSequencerCycles >= 8192) {
-                apu.frameSequencerCycles -= 8192;
-                tickFrameSequencer(state);
-            }
+            if (count > space) count = space;
+            memcpy(out, frames, count * 2 * sizeof(int16_t));
+            apu.bufferPosition += count;
+        }
+
+        static inline bool anyChannelEnabled(const APUState& apu) {
+            return apu.ch1.enabled || apu.ch2.enabled || apu.ch3.enabled || apu.ch4.enabled;
+        }
+
+        //all channels off: every output sample is zero, only keep the
+        //waveform positions moving so a retrigger sounds the same
+        static void advanceSilent(GBState& state, int cycles) {
+            advanceChannel1(state, cycles);
+            advanceChannel2(state, cycles);
+            advanceChannel3(state, cycles);
+            advanceChannel4(state, cycles);
+        }
+
+        static void runPointSampled(GBState& state, int cycles) {
+            auto& apu = state.apu;
 
             apu.sampleCycles += cycles;
+
+            if (!anyChannelEnabled(apu) && apu.sampleCycles >= CYCLES_PER_SAMPLE) {
+                //all silent: write the zero samples in one go
+                int count = apu.sampleCycles / CYCLES_PER_SAMPLE;
+                apu.sampleCycles -= count * CYCLES_PER_SAMPLE;
+                advanceSilent(state, count * CYCLES_PER_SAMPLE);
+
+                if (apu.blockPosition > 0) {
+                    mixBlock(state);
+                }
+                if (apu.sampleRate != SAMPLE_RATE) {
+                    static const int16_t silence[APUState::MIX_BLOCK * 2] = {};
+                    while (count > 0) {
+                        int chunk = count < APUState::MIX_BLOCK ? count : APUState::MIX_BLOCK;
+                        outputFrames(state, silence, chunk);
+                        count -= chunk;
+                    }
+                    return;
+                }
+                int space = APUState::BUFFER_SIZE - apu.bufferPosition;
+                if (count > space) count = space;
+                memset(&apu.audioBuffer[apu.bufferPosition * 2], 0, count * 2 * sizeof(int16_t));
+                apu.bufferPosition += count;
+                return;
+            }
+
             while (apu.sampleCycles >= CYCLES_PER_SAMPLE) {
                 apu.sampleCycles -= CYCLES_PER_SAMPLE;
                 generateSample(state);
             }
         }
 
+        void tick(GBState& state, int cycles) {
+            auto& apu = state.apu;
+
+            if (apu.mode == AudioMode::OFF) {
+                return;
+            }
+
+            //register only: lengths, envelopes and sweep stay correct for
+            //games polling NR52, nothing is synthesized; also the fallback
+            //while no audio buffers are attached
+            if (apu.mode == AudioMode::REGISTER_ONLY || !apu.audioBuffer) {
+                if (!apu.masterEnable) return;
+
+                apu.frameSequencerCycles += cycles;
+                while (apu.frameSequencerCycles >= 8192) {
+                    apu.frameSequencerCycles -= 8192;
+                    tickFrameSequencer(state);
+                }
+                return;
+            }
+
+            if (!apu.masterEnable) {
+                //keep the band limited output silent while the apu is off
+                if (apu.synthesis == AudioSynthesis::BANDLIMITED) {
+                    while (cycles > 0) {
+                        int run = CYCLES_PER_FRAME - (int)apu.frameClocks;
+                        if (run > cycles) run = cycles;
+
+                        for (int i = 0; i < 4; i++) {
+                            setChannelOutput(state, i, 0, apu.frameClocks);
+                        }
+                        apu.frameClocks += run;
+                        cycles -= run;
+
+                        if (apu.frameClocks >= CYCLES_PER_FRAME) {
+                            endFrame(state);
+                        }
+                    }
+                }
+                return;
+            }
+
+            if (apu.synthesis == AudioSynthesis::BANDLIMITED) {
+                //run the channels up to each frame sequencer step so envelope
+                //and length changes land at the right clock, and up to the
+                //frame limit so blip frames close at the same clock however
+                //the cycles were handed over
+                while (cycles > 0) {
+                    int run = 8192 - apu.frameSequencerCycles;
+                    if (run > cycles) run = cycles;
+                    if (run > CYCLES_PER_FRAME - (int)apu.frameClocks) run = CYCLES_PER_FRAME - (int)apu.frameClocks;
+
+                    if (anyChannelEnabled(apu)) {
+                        runChannels(state, run);
+                    } else {
+                        for (int i = 0; i < 4; i++) {
+                            setChannelOutput(state, i, 0, apu.frameClocks);
+                        }
+                        advanceSilent(state, run);
+                        apu.frameClocks += run;
+                    }
+                    apu.frameSequencerCycles += run;
+                    cycles -= run;
+
+                    if (apu.frameSequencerCycles >= 8192) {
+                        apu.frameSequencerCycles -= 8192;
+                        tickFrameSequencer(state);
+                    }
+                    if (apu.frameClocks >= CYCLES_PER_FRAME) {
+                        endFrame(state);
+                    }
+                }
+                return;
+            }
+
+            //point sampled: the same split, so a long catch-up run does not
+            //apply every frame sequencer step ahead of its samples
+            while (cycles > 0) {
+                int run = 8192 - apu.frameSequencerCycles;
+                if (run > cycles) run = cycles;
+
+                runPointSampled(state, run);
+                apu.frameSequencerCycles += run;
+                cycles -= run;
+
+                if (apu.frameSequencerCycles >= 8192) {
+                    apu.frameSequencerCycles -= 8192;
+                    tickFrameSequencer(state);
+                }
+            }
+        }
+
+        void catchUp(GBState& state) {
+            auto& apu = state.apu;
+
+            //bounded pieces so a long gap cannot outgrow the frame buffers
+            while (apu.lastSync < state.scheduler.cycles) {
+                uint64_t gap = state.scheduler.cycles - apu.lastSync;
+                int cycles = gap < CATCH_UP_CHUNK ? (int)gap : CATCH_UP_CHUNK;
+                apu.lastSync += cycles;
+                tick(state, cycles);
+            }
+        }
+
         void tickFrameSequencer(GBState& state) {
             auto& apu = state.apu;
             auto& io = state.memory.io;
@@ -214,111 +510,479 @@ namespace gb {
             apu.frameSequencerStep = (apu.frameSequencerStep + 1) & 7;
         }
 
-        void tickChannel1(GBState& state) {
-            auto& ch1 = state.apu.ch1;
+        //timer periods in cycles
+        template <typename Channel>
+        static inline int squarePeriod(const Channel& ch) {
+            return (2048 - ch.frequency) * 4;
+        }
 
-            ch1.frequencyTimer--;
-            if (ch1.frequencyTimer <= 0) {
-                ch1.frequencyTimer = (2048 - ch1.frequency) * 4;
-                ch1.dutyPosition = (ch1.dutyPosition + 1) & 7;
+        static inline int wavePeriod(const Channel3State& ch3) {
+            return (2048 - ch3.frequency) * 2;
+        }
+
+        static inline int noisePeriod(const Channel4State& ch4) {
+            int divisor = ch4.divisor == 0 ? 8 : ch4.divisor * 16;
+            return divisor << ch4.shiftAmount;
+        }
+
+        //closed form timer advance: returns how many times the timer expired
+        //over cycles and leaves frequencyTimer at the cycles left to the next one
+        static inline int advanceTimer(int& frequencyTimer, int period, int cycles) {
+            //a timer at 0 (never triggered) expires on the next cycle
+            int timer = frequencyTimer > 0 ? frequencyTimer : 1;
+
+            if (cycles < timer) {
+                frequencyTimer = timer - cycles;
+                return 0;
             }
+
+            cycles -= timer;
+            frequencyTimer = period - (cycles % period);
+            return 1 + cycles / period;
         }
 
-        void tickChannel2(GBState& state) {
+        //15 bit state at a sequence position: bit k is the output k steps later
+        static inline uint16_t lfsr15State(int index) {
+            return sequenceWindow(lfsr15Bits, index) & 0x7FFF;
+        }
+
+        //width mode state: the low 7 bits come from the 7 bit sequence, bits 7-14
+        //hold the last 8 feedback bits (valid once 8 steps ran in this mode)
+        static inline uint16_t lfsr7State(int index) {
+            uint16_t state = sequenceWindow(lfsr7Bits, index) & 0x7F;
+            for (int j = 0; j < 8; j++) {
+                int k = (index + 6 - j + LFSR7_PERIOD) % LFSR7_PERIOD;
+                state |= sequenceBit(lfsr7Bits, k) << (14 - j);
+            }
+            return state;
+        }
+
+        //position of the current state in the sequence of its mode, -1 if stuck at 0
+        static inline int lfsrIndex(const Channel4State& ch4) {
+            if (ch4.widthMode) {
+                int low = ch4.lfsr & 0x7F;
+                return low ? lfsr7Index[low] : -1;
+            }
+            return ch4.lfsr ? lfsr15Index[ch4.lfsr] : -1;
+        }
+
+        static inline void stepLFSR(Channel4State& ch4, int steps) {
+            //short hops are cheaper bit by bit (and keep width mode switches exact)
+            if (steps < 16) {
+                for (int i = 0; i < steps; i++) {
+                    uint8_t bit = (ch4.lfsr & 1) ^ ((ch4.lfsr >> 1) & 1);
+                    ch4.lfsr = (ch4.lfsr >> 1) | (bit << 14);
+
+                    if (ch4.widthMode) {
+                        ch4.lfsr &= ~0x40;
+                        ch4.lfsr |= bit << 6;
+                    }
+                }
+                return;
+            }
+
+            int index = lfsrIndex(ch4);
+            if (index < 0) {
+                ch4.lfsr = 0; //a zero lfsr never leaves zero
+            } else if (ch4.widthMode) {
+                ch4.lfsr = lfsr7State((index + steps) % LFSR7_PERIOD);
+            } else {
+                ch4.lfsr = lfsr15State((index + steps) % LFSR15_PERIOD);
+            }
+        }
+
+        void advanceChannel1(GBState& state, int cycles) {
+            auto& ch1 = state.apu.ch1;
+            int steps = advanceTimer(ch1.frequencyTimer, squarePeriod(ch1), cycles);
+            ch1.dutyPosition = (ch1.dutyPosition + steps) & 7;
+        }
+
+        void advanceChannel2(GBState& state, int cycles) {
             auto& ch2 = state.apu.ch2;
+            int steps = advanceTimer(ch2.frequencyTimer, squarePeriod(ch2), cycles);
+            ch2.dutyPosition = (ch2.dutyPosition + steps) & 7;
+        }
+
+        void advanceChannel3(GBState& state, int cycles) {
+            auto& ch3 = state.apu.ch3;
+            int steps = advanceTimer(ch3.frequencyTimer, wavePeriod(ch3), cycles);
+            ch3.position = (ch3.position + steps) & 31;
+        }
+
+        void advanceChannel4(GBState& state, int cycles) {
+            auto& ch4 = state.apu.ch4;
+            int steps = advanceTimer(ch4.frequencyTimer, noisePeriod(ch4), cycles);
+            stepLFSR(ch4, steps);
+        }
+
+        //band limited runs: walk the channel from edge to edge over cycles,
+        //handing every amplitude change to the mixer at the clock it happens.
+        //timers faster than MIN_EDGE_PERIOD are far above the audible range,
+        //those channels are advanced in closed form and held silent
+        static constexpr int MIN_EDGE_PERIOD = 8;
+
+        template <typename Channel>
+        static void runSquare(GBState& state, Channel& ch, int index, uint32_t time, int cycles) {
+            int period = squarePeriod(ch);
+
+            if (!ch.enabled || ch.volume == 0 || period < MIN_EDGE_PERIOD) {
+                setChannelOutput(state, index, 0, time);
+                int steps = advanceTimer(ch.frequencyTimer, period, cycles);
+                ch.dutyPosition = (ch.dutyPosition + steps) & 7;
+                return;
+            }
+
+            setChannelOutput(state, index, squareOutput(ch), time);
+
+            uint8_t pattern = dutyPatterns[ch.duty];
+            int timer = ch.frequencyTimer > 0 ? ch.frequencyTimer : 1;
 
-            ch2.frequencyTimer--;
-            if (ch2.frequencyTimer <= 0) {
-                ch2.frequencyTimer = (2048 - ch2.frequency) * 4;
-                ch2.dutyPosition = (ch2.dutyPosition + 1) & 7;
+            for (;;) {
+                //duty steps until the output bit flips
+                int bit = (pattern >> ch.dutyPosition) & 1;
+                int steps = 1;
+                while (((pattern >> ((ch.dutyPosition + steps) & 7)) & 1) == bit) {
+                    steps++;
+                }
+
+                int until = timer + (steps - 1) * period;
+                if (until > cycles) break;
+
+                time += until;
+                cycles -= until;
+                timer = period;
+                ch.dutyPosition = (ch.dutyPosition + steps) & 7;
+                setChannelOutput(state, index, squareOutput(ch), time);
             }
+
+            //no edge left in this run, the rest is closed form
+            ch.frequencyTimer = timer;
+            int steps = advanceTimer(ch.frequencyTimer, period, cycles);
+            ch.dutyPosition = (ch.dutyPosition + steps) & 7;
         }
 
-        void tickChannel3(GBState& state) {
+        static void runWave(GBState& state, uint32_t time, int cycles) {
             auto& ch3 = state.apu.ch3;
+            int period = wavePeriod(ch3);
+
+            if (!ch3.enabled || !ch3.dacEnabled || period < MIN_EDGE_PERIOD) {
+                setChannelOutput(state, 2, 0, time);
+                advanceChannel3(state, cycles);
+                return;
+            }
 
-            ch3.frequencyTimer--;
-            if (ch3.frequencyTimer <= 0) {
-                ch3.frequencyTimer = (2048 - ch3.frequency) * 2;
+            setChannelOutput(state, 2, waveOutput(state), time);
+
+            int timer = ch3.frequencyTimer > 0 ? ch3.frequencyTimer : 1;
+            while (timer <= cycles) {
+                time += timer;
+                cycles -= timer;
+                timer = period;
                 ch3.position = (ch3.position + 1) & 31;
+                setChannelOutput(state, 2, waveOutput(state), time);
             }
+            ch3.frequencyTimer = timer - cycles;
         }
 
-        void tickChannel4(GBState& state) {
+        static void runNoise(GBState& state, uint32_t time, int cycles) {
             auto& ch4 = state.apu.ch4;
 
-            ch4.frequencyTimer--;
-            if (ch4.frequencyTimer <= 0) {
-                int divisor = ch4.divisor == 0 ? 8 : ch4.divisor * 16;
-                ch4.frequencyTimer = divisor << ch4.shiftAmount;
+            if (!ch4.enabled || ch4.volume == 0) {
+                setChannelOutput(state, 3, 0, time);
+                advanceChannel4(state, cycles);
+                return;
+            }
+
+            setChannelOutput(state, 3, noiseOutput(ch4), time);
 
-                uint8_t bit = (ch4.lfsr & 1) ^ ((ch4.lfsr >> 1) & 1);
-                ch4.lfsr = (ch4.lfsr >> 1) | (bit << 14);
+            int period = noisePeriod(ch4);
+            int timer = ch4.frequencyTimer > 0 ? ch4.frequencyTimer : 1;
+            int index = lfsrIndex(ch4);
+
+            //stuck lfsr: constant output, nothing to walk
+            if (index < 0) {
+                advanceChannel4(state, cycles);
+                return;
+            }
 
-                if (ch4.widthMode) {
-                    ch4.lfsr &= ~0x40;
-                    ch4.lfsr |= bit << 6;
+            //walk the precomputed sequence run by run: one lookup finds how many
+            //steps the output bit stays the same
+            const uint32_t* bits = ch4.widthMode ? lfsr7Bits : lfsr15Bits;
+            int length = ch4.widthMode ? LFSR7_PERIOD : LFSR15_PERIOD;
+            int steps = 0;
+
+            for (;;) {
+                uint32_t window = sequenceWindow(bits, index);
+                uint32_t flips = window ^ (0u - (window & 1));
+                int run = flips ? __builtin_ctz(flips) : 32;
+
+                int until = timer + (run - 1) * period;
+                if (until > cycles) break;
+
+                time += until;
+                cycles -= until;
+                timer = period;
+                steps += run;
+                index = (index + run) % length;
+
+                //an edge only when the run really ended before the window did
+                if (run < 32) {
+                    int amplitude = sequenceBit(bits, index) ? -ch4.volume : ch4.volume;
+                    setChannelOutput(state, 3, amplitude, time);
                 }
             }
+
+            //steps left before the next edge, then materialize the real lfsr
+            ch4.frequencyTimer = timer;
+            steps += advanceTimer(ch4.frequencyTimer, period, cycles);
+            stepLFSR(ch4, steps);
+        }
+
+        void runChannels(GBState& state, int cycles) {
+            auto& apu = state.apu;
+            uint32_t time = apu.frameClocks;
+
+            runSquare(state, apu.ch1, 0, time, cycles);
+            runSquare(state, apu.ch2, 1, time, cycles);
+            runWave(state, time, cycles);
+            runNoise(state, time, cycles);
+
+            apu.frameClocks += cycles;
         }
 
         void generateSample(GBState& state) {
             auto& apu = state.apu;
-            auto& mem = state.memory;
 
-            tickChannel1(state);
-            tickChannel2(state);
-            tickChannel3(state);
-            tickChannel4(state);
+            advanceChannel1(state, CYCLES_PER_SAMPLE);
+            advanceChannel2(state, CYCLES_PER_SAMPLE);
+            advanceChannel3(state, CYCLES_PER_SAMPLE);
+            advanceChannel4(state, CYCLES_PER_SAMPLE);
+
+            int ch1 = squareOutput(apu.ch1);
+            int ch2 = squareOutput(apu.ch2);
+            int ch3 = waveOutput(state);
+            int ch4 = noiseOutput(apu.ch4);
+
+            if (apu.blockMixing) {
+                int i = apu.blockPosition;
+                apu.blockSamples[0][i] = ch1;
+                apu.blockSamples[1][i] = ch2;
+                apu.blockSamples[2][i] = ch3;
+                apu.blockSamples[3][i] = ch4;
+                apu.blockPosition++;
+                if (apu.blockPosition == APUState::MIX_BLOCK) {
+                    mixBlock(state);
+                }
+                return;
+            }
 
             int16_t left = 0;
             int16_t right = 0;
 
-            if (apu.ch1.enabled) {
-                uint8_t duty = dutyPatterns[apu.ch1.duty];
-                int sample = (duty >> apu.ch1.dutyPosition) & 1 ? apu.ch1.volume : -apu.ch1.volume;
-                if (apu.ch1Left) left += sample;
-                if (apu.ch1Right) right += sample;
+            if (apu.ch1Left) left += ch1;
+            if (apu.ch1Right) right += ch1;
+            if (apu.ch2Left) left += ch2;
+            if (apu.ch2Right) right += ch2;
+            if (apu.ch3Left) left += ch3;
+            if (apu.ch3Right) right += ch3;
+            if (apu.ch4Left) left += ch4;
+            if (apu.ch4Right) right += ch4;
+
+            left = (left * apu.masterVolumeLeft * 64);
+            right = (right * apu.masterVolumeRight * 64);
+
+            if (apu.sampleRate != SAMPLE_RATE) {
+                int16_t frame[2] = { left, right };
+                outputFrames(state, frame, 1);
+                return;
             }
 
-            if (apu.ch2.enabled) {
-                uint8_t duty = dutyPatterns[apu.ch2.duty];
-                int sample = (duty >> apu.ch2.dutyPosition) & 1 ? apu.ch2.volume : -apu.ch2.volume;
-                if (apu.ch2Left) left += sample;
-                if (apu.ch2Right) right += sample;
+            if (apu.bufferPosition < APUState::BUFFER_SIZE) {
+                apu.audioBuffer[apu.bufferPosition * 2] = left;
+                apu.audioBuffer[apu.bufferPosition * 2 + 1] = right;
+                apu.bufferPosition++;
             }
+        }
 
-            if (apu.ch3.enabled && apu.ch3.dacEnabled) {
-                uint8_t sampleByte = mem.io[0x30 + (apu.ch3.position / 2)];
-                uint8_t sample4bit = (apu.ch3.position & 1) ? (sampleByte & 0x0F) : (sampleByte >> 4);
+        void mixBlock(GBState& state) {
+            auto& apu = state.apu;
 
-                int shift = 0;
-                switch (apu.ch3.volume) {
-                    case 0: shift = 4; break;
-                    case 1: shift = 0; break;
-                    case 2: shift = 1; break;
-                    case 3: shift = 2; break;
+            int count = apu.blockPosition;
+            apu.blockPosition = 0;
+
+            //mix straight into the audio buffer at the native rate, through a
+            //scratch block when it still has to be resampled
+            bool resample = apu.sampleRate != SAMPLE_RATE;
+            int16_t mixed[APUState::MIX_BLOCK * 2];
+
+            //same drop behaviour as the scalar path once the buffer is full
+            int space = APUState::BUFFER_SIZE - apu.bufferPosition;
+            if (!resample && count > space) count = space;
+            if (count <= 0) return;
+
+            const int16_t* c1 = apu.blockSamples[0];
+            const int16_t* c2 = apu.blockSamples[1];
+            const int16_t* c3 = apu.blockSamples[2];
+            const int16_t* c4 = apu.blockSamples[3];
+            int16_t* out = resample ? mixed : &apu.audioBuffer[apu.bufferPosition * 2];
+
+            //branch free panning: every channel is and-ed with an all ones / zero mask.
+            //all sums stay within int16 (60 * 7 * 64 max), so the wrapping 16 bit
+            //lanes give exactly the scalar result
+            int16_t scaleLeft = apu.masterVolumeLeft * 64;
+            int16_t scaleRight = apu.masterVolumeRight * 64;
+            int16_t m1l = apu.ch1Left ? -1 : 0, m1r = apu.ch1Right ? -1 : 0;
+            int16_t m2l = apu.ch2Left ? -1 : 0, m2r = apu.ch2Right ? -1 : 0;
+            int16_t m3l = apu.ch3Left ? -1 : 0, m3r = apu.ch3Right ? -1 : 0;
+            int16_t m4l = apu.ch4Left ? -1 : 0, m4r = apu.ch4Right ? -1 : 0;
+
+            int i = 0;
+
+#if defined(__ARM_FEATURE_SIMD32)
+            //armv6 simd32: two frames per 32 bit word, two 16 bit lanes
+            uint32_t w1l = (uint16_t)m1l * 0x10001u, w1r = (uint16_t)m1r * 0x10001u;
+            uint32_t w2l = (uint16_t)m2l * 0x10001u, w2r = (uint16_t)m2r * 0x10001u;
+            uint32_t w3l = (uint16_t)m3l * 0x10001u, w3r = (uint16_t)m3r * 0x10001u;
+            uint32_t w4l = (uint16_t)m4l * 0x10001u, w4r = (uint16_t)m4r * 0x10001u;
+
+            for (; i + 2 <= count; i += 2) {
+                uint32_t s1, s2, s3, s4;
+                memcpy(&s1, c1 + i, 4);
+                memcpy(&s2, c2 + i, 4);
+                memcpy(&s3, c3 + i, 4);
+                memcpy(&s4, c4 + i, 4);
+
+                int16x2_t left = __sadd16(__sadd16(s1 & w1l, s2 & w2l), __sadd16(s3 & w3l, s4 & w4l));
+                int16x2_t right = __sadd16(__sadd16(s1 & w1r, s2 & w2r), __sadd16(s3 & w3r, s4 & w4r));
+
+                //halfword multiplies (smulbb / smultb)
+                out[i * 2] = (int16_t)left * scaleLeft;
+                out[i * 2 + 1] = (int16_t)right * scaleRight;
+                out[i * 2 + 2] = (int16_t)(left >> 16) * scaleLeft;
+                out[i * 2 + 3] = (int16_t)(right >> 16) * scaleRight;
+            }
+#elif defined(__GNUC__)
+            //generic vectors, eight frames per step (sse2 / neon, scalar otherwise)
+            typedef int16_t v8i16 __attribute__((vector_size(16)));
+
+            for (; i + 8 <= count; i += 8) {
+                v8i16 s1, s2, s3, s4;
+                memcpy(&s1, c1 + i, sizeof(s1));
+                memcpy(&s2, c2 + i, sizeof(s2));
+                memcpy(&s3, c3 + i, sizeof(s3));
+                memcpy(&s4, c4 + i, sizeof(s4));
+
+                v8i16 left = ((s1 & m1l) + (s2 & m2l) + (s3 & m3l) + (s4 & m4l)) * scaleLeft;
+                v8i16 right = ((s1 & m1r) + (s2 & m2r) + (s3 & m3r) + (s4 & m4r)) * scaleRight;
+
+                for (int j = 0; j < 8; j++) {
+                    out[(i + j) * 2] = left[j];
+                    out[(i + j) * 2 + 1] = right[j];
                 }
+            }
+#endif
 
-                int sample = (sample4bit >> shift) - 8;
-                if (apu.ch3Left) left += sample;
-                if (apu.ch3Right) right += sample;
+            for (; i < count; i++) {
+                int16_t left = (c1[i] & m1l) + (c2[i] & m2l) + (c3[i] & m3l) + (c4[i] & m4l);
+                int16_t right = (c1[i] & m1r) + (c2[i] & m2r) + (c3[i] & m3r) + (c4[i] & m4r);
+                out[i * 2] = left * scaleLeft;
+                out[i * 2 + 1] = right * scaleRight;
             }
 
-            if (apu.ch4.enabled) {
-                int sample = (apu.ch4.lfsr & 1) ? -apu.ch4.volume : apu.ch4.volume;
-                if (apu.ch4Left) left += sample;
-                if (apu.ch4Right) right += sample;
+            if (resample) {
+                outputFrames(state, mixed, count);
+            } else {
+                apu.bufferPosition += count;
             }
+        }
 
-            left = (left * apu.masterVolumeLeft * 64);
-            right = (right * apu.masterVolumeRight * 64);
+        void setBlockMixing(GBState& state, bool enabled) {
+            if (state.apu.blockPosition > 0) {
+                mixBlock(state);
+            }
+            state.apu.blockMixing = enabled;
+        }
 
-            if (apu.bufferPosition < APUState::BUFFER_SIZE) {
-                apu.audioBuffer[apu.bufferPosition * 2] = left;
-                apu.audioBuffer[apu.bufferPosition * 2 + 1] = right;
-                apu.bufferPosition++;
+        void endFrame(GBState& state) {
+            auto& apu = state.apu;
+
+            if (apu.blockPosition > 0) {
+                mixBlock(state);
+            }
+
+            if (apu.synthesis == AudioSynthesis::BANDLIMITED && apu.audioBuffer) {
+                blip::endFrame(apu.blipLeft, apu.frameClocks);
+                blip::endFrame(apu.blipRight, apu.frameClocks);
+
+                //resample the whole frame in one pass, whatever does not fit is dropped
+                int available = blip::samplesAvailable(apu.blipLeft);
+                int space = APUState::BUFFER_SIZE - apu.bufferPosition;
+                int count = available < space ? available : space;
+
+                int16_t* out = &apu.audioBuffer[apu.bufferPosition * 2];
+                blip::readSamples(apu.blipLeft, out, count, 2);
+                blip::readSamples(apu.blipRight, out + 1, count, 2);
+                apu.bufferPosition += count;
+
+                blip::readSamples(apu.blipLeft, nullptr, available - count, 2);
+                blip::readSamples(apu.blipRight, nullptr, available - count, 2);
+            }
+
+            apu.frameClocks = 0;
+        }
+
+        void setMode(GBState& state, AudioMode mode) {
+            auto& apu = state.apu;
+
+            if (mode == apu.mode) return;
+
+            //flush what the full mode produced, restart the output clean
+            endFrame(state);
+            blip::clear(apu.blipLeft);
+            blip::clear(apu.blipRight);
+            for (int i = 0; i < 4; i++) {
+                apu.channelOutput[i] = 0;
+            }
+            apu.mixLeft = 0;
+            apu.mixRight = 0;
+            apu.sampleCycles = 0;
+            apu.mode = mode;
+        }
+
+        void setSampleRate(GBState& state, int sampleRate) {
+            auto& apu = state.apu;
+
+            if (sampleRate < MIN_SAMPLE_RATE) sampleRate = MIN_SAMPLE_RATE;
+            if (sampleRate > MAX_SAMPLE_RATE) sampleRate = MAX_SAMPLE_RATE;
+
+            //finish the frame at the old rate before switching
+            endFrame(state);
+
+            apu.sampleRate = sampleRate;
+            resampler::configure(apu.resampler, SAMPLE_RATE, sampleRate);
+
+            //blip buffers resample directly to the output rate
+            blip::initialize(apu.blipLeft, sampleRate);
+            blip::initialize(apu.blipRight, sampleRate);
+            for (int i = 0; i < 4; i++) {
+                apu.channelOutput[i] = 0;
             }
+            apu.mixLeft = 0;
+            apu.mixRight = 0;
+        }
+
+        void setSynthesis(GBState& state, AudioSynthesis synthesis) {
+            auto& apu = state.apu;
+
+            endFrame(state);
+            blip::clear(apu.blipLeft);
+            blip::clear(apu.blipRight);
+            for (int i = 0; i < 4; i++) {
+                apu.channelOutput[i] = 0;
+            }
+            apu.mixLeft = 0;
+            apu.mixRight = 0;
+            apu.synthesis = synthesis;
         }
 
         void writeRegister(GBState& state, uint8_t reg, uint8_t value) {
@@ -329,8 +993,15 @@ namespace gb {
             auto& ch3 = apu.ch3;
             auto& ch4 = apu.ch4;
 
+            catchUp(state);
+
             io[reg] = value;
 
+            //the pending block was sampled with the old panning / volume
+            if ((reg == 0x24 || reg == 0x25) && apu.blockPosition > 0) {
+                mixBlock(state);
+            }
+
             switch (reg) {
                 case 0x10:
                     ch1.sweepPeriod = (value >> 4) & 0x07;
@@ -413,6 +1084,7 @@ namespace gb {
 
                 case 0x1C:
                     ch3.volume = (value >> 5) & 0x03;
+                    rebuildWaveTable(state);
                     break;
 
                 case 0x1D:
@@ -464,6 +1136,9 @@ namespace gb {
                 case 0x24:
                     apu.masterVolumeLeft = (value >> 4) & 0x07;
                     apu.masterVolumeRight = value & 0x07;
+                    if (apu.synthesis == AudioSynthesis::BANDLIMITED) {
+                        updateMix(state, apu.frameClocks);
+                    }
                     break;
 
                 case 0x25:
@@ -475,6 +1150,16 @@ namespace gb {
                     apu.ch3Right = value & 0x04;
                     apu.ch2Right = value & 0x02;
                     apu.ch1Right = value & 0x01;
+                    if (apu.synthesis == AudioSynthesis::BANDLIMITED) {
+                        updateMix(state, apu.frameClocks);
+                    }
+                    break;
+
+                case 0x30: case 0x31: case 0x32: case 0x33:
+                case 0x34: case 0x35: case 0x36: case 0x37:
+                case 0x38: case 0x39: case 0x3A: case 0x3B:
+                case 0x3C: case 0x3D: case 0x3E: case 0x3F:
+                    decodeWaveByte(ch3, reg - 0x30, value);
                     break;
 
                 case 0x26:
@@ -493,6 +1178,8 @@ namespace gb {
             auto& apu = state.apu;
             auto& io = state.memory.io;
 
+            catchUp(state);
+
             switch (reg) {
                 case 0x26: {
                     uint8_t status = apu.masterEnable ? 0x80 : 0x00;
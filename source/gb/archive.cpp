@@ -0,0 +1,178 @@
+#include "included/archive.hpp"
+#include "included/inflate.hpp"
+#include <cstring>
+#include <cctype>
+
+namespace gb {
+    namespace archive {
+
+        static constexpr uint32_t ZIP_LOCAL_HEADER = 0x04034B50;
+        static constexpr uint32_t ZIP_CENTRAL_HEADER = 0x02014B50;
+        static constexpr uint32_t ZIP_END_RECORD = 0x06054B50;
+        static constexpr int ZIP_END_SIZE = 22;
+        static constexpr int ZIP_MAX_COMMENT = 0xFFFF;
+
+        static constexpr uint8_t GZIP_FHCRC = 0x02;
+        static constexpr uint8_t GZIP_FEXTRA = 0x04;
+        static constexpr uint8_t GZIP_FNAME = 0x08;
+        static constexpr uint8_t GZIP_FCOMMENT = 0x10;
+
+        //all multi byte fields are little endian
+        static inline uint16_t get16(const uint8_t* p) {
+            return p[0] | (p[1] << 8);
+        }
+
+        static inline uint32_t get32(const uint8_t* p) {
+            return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+        }
+
+        Format detect(const uint8_t* data, size_t size) {
+            if (size >= 18 && data[0] == 0x1F && data[1] == 0x8B && data[2] == 8) {
+                return Format::GZIP;
+            }
+            if (size >= (size_t)ZIP_END_SIZE && get32(data) == ZIP_LOCAL_HEADER) {
+                return Format::ZIP;
+            }
+            return Format::RAW;
+        }
+
+        //decodes into a buffer of the size the container promised and checks
+        //that the stream produced exactly that, with the matching crc
+        static bool unpack(const uint8_t* data, size_t size, bool deflated, uint32_t expectedSize,
+                           uint32_t expectedCrc, int maxSize, uint8_t*& image, int& imageSize) {
+            if (expectedSize == 0 || expectedSize > (uint32_t)maxSize) {
+                return false;
+            }
+
+            uint8_t* buffer = new uint8_t[expectedSize];
+            size_t written = 0;
+            bool ok;
+            if (deflated) {
+                ok = inflate::decode(data, size, buffer, expectedSize, nullptr, &written);
+            } else {
+                ok = size >= expectedSize;
+                if (ok) {
+                    memcpy(buffer, data, expectedSize);
+                    written = expectedSize;
+                }
+            }
+
+            if (!ok || written != expectedSize || inflate::crc32(buffer, written) != expectedCrc) {
+                delete[] buffer;
+                return false;
+            }
+
+            image = buffer;
+            imageSize = (int)expectedSize;
+            return true;
+        }
+
+        static bool extractGzip(const uint8_t* data, size_t size, int maxSize, uint8_t*& image, int& imageSize) {
+            uint8_t flags = data[3];
+            size_t offset = 10;
+
+            if (flags & GZIP_FEXTRA) {
+                if (offset + 2 > size) return false;
+                offset += 2 + get16(data + offset);
+            }
+            if (flags & GZIP_FNAME) {
+                while (offset < size && data[offset]) offset++;
+                offset++;
+            }
+            if (flags & GZIP_FCOMMENT) {
+                while (offset < size && data[offset]) offset++;
+                offset++;
+            }
+            if (flags & GZIP_FHCRC) {
+                offset += 2;
+            }
+            if (offset + 8 > size) return false;
+
+            //the trailer carries the crc and the size (mod 2^32) of the member
+            const uint8_t* trailer = data + size - 8;
+            return unpack(data + offset, size - 8 - offset, true, get32(trailer + 4), get32(trailer),
+                          maxSize, image, imageSize);
+        }
+
+        static bool hasRomExtension(const uint8_t* name, int length) {
+            static const char* extensions[] = { ".gb", ".gbc", ".sgb" };
+
+            for (const char* ext : extensions) {
+                int extLength = (int)strlen(ext);
+                if (length <= extLength) continue;
+
+                bool match = true;
+                for (int i = 0; i < extLength && match; i++) {
+                    match = tolower(name[length - extLength + i]) == ext[i];
+                }
+                if (match) return true;
+            }
+            return false;
+        }
+
+        static bool extractZip(const uint8_t* data, size_t size, int maxSize, uint8_t*& image, int& imageSize) {
+            //the end record sits behind an optional comment, search backwards
+            size_t floor = size > (size_t)(ZIP_END_SIZE + ZIP_MAX_COMMENT) ? size - ZIP_END_SIZE - ZIP_MAX_COMMENT : 0;
+            size_t end = size - ZIP_END_SIZE + 1;
+            do {
+                end--;
+                if (get32(data + end) == ZIP_END_RECORD) break;
+            } while (end > floor);
+            if (get32(data + end) != ZIP_END_RECORD) return false;
+
+            int entries = get16(data + end + 10);
+            size_t directory = get32(data + end + 16);
+
+            //pick the entry first, then go through its local header
+            const uint8_t* chosen = nullptr;
+            const uint8_t* fallback = nullptr;
+            size_t offset = directory;
+            for (int i = 0; i < entries; i++) {
+                if (offset + 46 > size || get32(data + offset) != ZIP_CENTRAL_HEADER) return false;
+
+                const uint8_t* header = data + offset;
+                int nameLength = get16(header + 28);
+                if (offset + 46 + nameLength > size) return false;
+
+                bool directoryEntry = nameLength > 0 && header[46 + nameLength - 1] == '/';
+                if (!directoryEntry && get32(header + 24) > 0) {
+                    if (hasRomExtension(header + 46, nameLength)) {
+                        chosen = header;
+                        break;
+                    }
+                    if (!fallback) fallback = header;
+                }
+
+                offset += 46 + nameLength + get16(header + 30) + get16(header + 32);
+            }
+            if (!chosen) chosen = fallback;
+            if (!chosen) return false;
+
+            uint16_t flags = get16(chosen + 8);
+            uint16_t method = get16(chosen + 10);
+            if ((flags & 0x01) || (method != 0 && method != 8)) {
+                return false; //encrypted, or a method other than stored / deflate
+            }
+
+            uint32_t crc = get32(chosen + 16);
+            uint32_t packedSize = get32(chosen + 20);
+            uint32_t fullSize = get32(chosen + 24);
+            size_t local = get32(chosen + 42);
+
+            if (local + 30 > size || get32(data + local) != ZIP_LOCAL_HEADER) return false;
+            size_t start = local + 30 + get16(data + local + 26) + get16(data + local + 28);
+            if (start > size || packedSize > size - start) return false;
+
+            return unpack(data + start, packedSize, method == 8, fullSize, crc, maxSize, image, imageSize);
+        }
+
+        bool extract(const uint8_t* data, size_t size, int maxSize, uint8_t*& image, int& imageSize) {
+            switch (detect(data, size)) {
+                case Format::GZIP: return extractGzip(data, size, maxSize, image, imageSize);
+                case Format::ZIP: return extractZip(data, size, maxSize, image, imageSize);
+                default: return false;
+            }
+        }
+
+    }
+}
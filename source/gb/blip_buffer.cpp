@@ -0,0 +1,130 @@
+#include "included/blip_buffer.hpp"
+#include "included/state.hpp"
+#include <cstring>
+#include <cmath>
+
+namespace gb {
+    namespace blip {
+
+        //windowed sinc impulse, one row per sub-sample phase
+        int16_t kernel[PHASES][KERNEL_TAPS];
+
+        void designKernel(int16_t (*table)[KERNEL_TAPS], double cutoff) {
+            const double pi = 3.14159265358979323846;
+            const double half = KERNEL_TAPS / 2;
+
+            for (int phase = 0; phase < PHASES; phase++) {
+                double frac = (double)phase / PHASES;
+                double taps[KERNEL_TAPS];
+                double sum = 0.0;
+
+                for (int i = 0; i < KERNEL_TAPS; i++) {
+                    //distance of this tap from the step, taps straddle it symmetrically
+                    double x = i - (half - 1) - frac;
+                    double t = x * cutoff;
+                    double sinc = (t == 0.0) ? 1.0 : sin(pi * t) / (pi * t);
+                    double window = 0.42 + 0.5 * cos(pi * x / half) + 0.08 * cos(2.0 * pi * x / half);
+                    taps[i] = sinc * window;
+                    sum += taps[i];
+                }
+
+                //normalize so every phase sums exactly to the unit, otherwise
+                //the integrator would drift away from the real amplitude
+                int total = 0;
+                int center = 0;
+                for (int i = 0; i < KERNEL_TAPS; i++) {
+                    int v = (int)floor(taps[i] / sum * (1 << KERNEL_BITS) + 0.5);
+                    table[phase][i] = (int16_t)v;
+                    total += v;
+                    if (taps[i] > taps[center]) center = i;
+                }
+                table[phase][center] += (1 << KERNEL_BITS) - total;
+            }
+        }
+
+        void buildKernel() {
+            //0.9 of nyquist leaves room for the window rolloff
+            designKernel(kernel, 0.9);
+        }
+
+        void initialize(BlipState& blip, int sampleRate) {
+            static bool kernelBuilt = false;
+            if (!kernelBuilt) {
+                buildKernel();
+                kernelBuilt = true;
+            }
+
+            blip.sampleRate = sampleRate;
+            clear(blip);
+        }
+
+        void clear(BlipState& blip) {
+            if (blip.deltas) {
+                memset(blip.deltas, 0, BlipState::DELTA_COUNT * sizeof(int32_t));
+            }
+            blip.offset = 0;
+            blip.integrator = 0;
+        }
+
+        void addDelta(BlipState& blip, uint32_t time, int delta) {
+            uint32_t pos = blip.offset + (uint32_t)(((uint64_t)time * blip.sampleRate) >> CLOCK_SHIFT);
+            uint32_t index = pos >> FRAC_BITS;
+
+            //frame too long for the buffer (or no buffer attached), drop
+            //rather than write out of bounds
+            if (index >= (uint32_t)BlipState::BUFFER_SIZE || !blip.deltas) {
+                return;
+            }
+
+            const int16_t* k = kernel[(pos >> (FRAC_BITS - PHASE_BITS)) & (PHASES - 1)];
+            int32_t* out = &blip.deltas[index];
+            for (int i = 0; i < KERNEL_TAPS; i++) {
+                out[i] += k[i] * delta;
+            }
+        }
+
+        void endFrame(BlipState& blip, uint32_t clocks) {
+            blip.offset += (uint32_t)(((uint64_t)clocks * blip.sampleRate) >> CLOCK_SHIFT);
+
+            uint32_t limit = (uint32_t)BlipState::BUFFER_SIZE << FRAC_BITS;
+            if (blip.offset > limit) {
+                blip.offset = limit;
+            }
+        }
+
+        int samplesAvailable(const BlipState& blip) {
+            return blip.offset >> FRAC_BITS;
+        }
+
+        int readSamples(BlipState& blip, int16_t* out, int count, int stride) {
+            int available = samplesAvailable(blip);
+            if (count > available) {
+                count = available;
+            }
+            if (count <= 0 || !blip.deltas) {
+                return 0;
+            }
+
+            int32_t sum = blip.integrator;
+            for (int i = 0; i < count; i++) {
+                sum += blip.deltas[i];
+                int sample = sum >> KERNEL_BITS;
+                if (sample > 32767) sample = 32767;
+                if (sample < -32768) sample = -32768;
+                if (out) {
+                    out[i * stride] = (int16_t)sample;
+                }
+            }
+            blip.integrator = sum;
+
+            //shift the unread samples and the kernel tail to the front
+            int remaining = available - count + KERNEL_TAPS;
+            memmove(blip.deltas, blip.deltas + count, remaining * sizeof(int32_t));
+            memset(blip.deltas + remaining, 0, count * sizeof(int32_t));
+            blip.offset -= (uint32_t)count << FRAC_BITS;
+
+            return count;
+        }
+
+    }
+}
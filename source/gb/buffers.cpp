@@ -0,0 +1,157 @@
+#include "included/buffers.hpp"
+#include "included/state.hpp"
+#include <cstring>
+#include <new>
+
+namespace gb {
+    namespace buffers {
+
+        static void bindAudio(GBState& state, AudioBuffers* audio) {
+            auto& apu = state.apu;
+
+            apu.audioBuffer = audio ? audio->samples : nullptr;
+            apu.blipLeft.deltas = audio ? audio->blipLeft : nullptr;
+            apu.blipRight.deltas = audio ? audio->blipRight : nullptr;
+        }
+
+#ifdef GB_COMPACT_STATE
+        static AudioBuffers* boundAudio(const GBState& state) {
+            //samples is the first member, so this recovers the allocation
+            return reinterpret_cast<AudioBuffers*>(state.apu.audioBuffer);
+        }
+
+        static VideoBuffers* boundVideo(const GBState& state) {
+            return reinterpret_cast<VideoBuffers*>(state.ppu.framebuffer);
+        }
+#endif
+
+        void initialize(GBState& state) {
+#ifdef GB_COMPACT_STATE
+            state.ppu.framebuffer = nullptr;
+            bindAudio(state, nullptr);
+#else
+            state.ppu.framebuffer = state.buffers.video.framebuffer;
+            bindAudio(state, &state.buffers.audio);
+#endif
+        }
+
+        void cleanup(GBState& state) {
+            detachVideo(state);
+            detachAudio(state);
+        }
+
+        bool attachVideo(GBState& state) {
+            if (state.ppu.framebuffer) return true;
+
+#ifdef GB_COMPACT_STATE
+            VideoBuffers* video = new (std::nothrow) VideoBuffers;
+            if (!video) return false;
+#else
+            VideoBuffers* video = &state.buffers.video;
+#endif
+
+            memset(video, 0, sizeof(VideoBuffers));
+            state.ppu.framebuffer = video->framebuffer;
+            return true;
+        }
+
+        void detachVideo(GBState& state) {
+#ifdef GB_COMPACT_STATE
+            delete boundVideo(state);
+#endif
+            state.ppu.framebuffer = nullptr;
+        }
+
+        bool attachAudio(GBState& state) {
+            auto& apu = state.apu;
+
+            if (apu.audioBuffer) return true;
+
+#ifdef GB_COMPACT_STATE
+            AudioBuffers* audio = new (std::nothrow) AudioBuffers;
+            if (!audio) return false;
+#else
+            AudioBuffers* audio = &state.buffers.audio;
+#endif
+
+            memset(audio, 0, sizeof(AudioBuffers));
+            bindAudio(state, audio);
+
+            //start from silence, the blip buffers were not tracking the mix
+            apu.bufferPosition = 0;
+            apu.blockPosition = 0;
+            apu.frameClocks = 0;
+            for (int i = 0; i < 4; i++) {
+                apu.channelOutput[i] = 0;
+            }
+            apu.mixLeft = 0;
+            apu.mixRight = 0;
+            apu.blipLeft.offset = 0;
+            apu.blipLeft.integrator = 0;
+            apu.blipRight.offset = 0;
+            apu.blipRight.integrator = 0;
+            return true;
+        }
+
+        void detachAudio(GBState& state) {
+#ifdef GB_COMPACT_STATE
+            delete boundAudio(state);
+#endif
+            bindAudio(state, nullptr);
+            state.apu.bufferPosition = 0;
+        }
+
+        size_t copy(GBState& target, const GBState& source) {
+#ifdef GB_COMPACT_STATE
+            //the pointers still lead into source's allocations
+            target.ppu.framebuffer = nullptr;
+            bindAudio(target, nullptr);
+
+            size_t copied = 0;
+            if (hasVideo(source)) {
+                VideoBuffers* video = new (std::nothrow) VideoBuffers;
+                if (video) {
+                    memcpy(video, boundVideo(source), sizeof(VideoBuffers));
+                    target.ppu.framebuffer = video->framebuffer;
+                    copied += sizeof(VideoBuffers);
+                }
+            }
+            if (hasAudio(source)) {
+                AudioBuffers* audio = new (std::nothrow) AudioBuffers;
+                if (audio) {
+                    memcpy(audio, boundAudio(source), sizeof(AudioBuffers));
+                    bindAudio(target, audio);
+                    copied += sizeof(AudioBuffers);
+                } else {
+                    target.apu.bufferPosition = 0;
+                }
+            }
+            return copied;
+#else
+            //inline buffers came along with the assignment, bound only if
+            //source had them bound
+            target.ppu.framebuffer = hasVideo(source) ? target.buffers.video.framebuffer : nullptr;
+            bindAudio(target, hasAudio(source) ? &target.buffers.audio : nullptr);
+            return 0;
+#endif
+        }
+
+        bool hasVideo(const GBState& state) {
+            return state.ppu.framebuffer != nullptr;
+        }
+
+        bool hasAudio(const GBState& state) {
+            return state.apu.audioBuffer != nullptr;
+        }
+
+        size_t heapBytes(const GBState& state) {
+#ifdef GB_COMPACT_STATE
+            return (hasVideo(state) ? sizeof(VideoBuffers) : 0) + (hasAudio(state) ? sizeof(AudioBuffers) : 0);
+#else
+            (void)state;
+            return 0;
+#endif
+        }
+
+    }
+}
@@ -1,16 +1,75 @@
 #include "included/cartridge.hpp"
 #include "included/state.hpp"
+#include "included/rom_cache.hpp"
 #include <cstring>
 #include <cstdio>
+#include <atomic>
 
 namespace gb {
     namespace cartridge {
 
+        static constexpr int ROM_BANK_SIZE = 0x4000;
+        static constexpr int RAM_BANK_SIZE = 0x2000;
+
+        //clones may run on other threads, so the count is atomic
+        struct SharedRAM {
+            std::atomic<int> refs;
+            uint8_t* data;
+        };
+
+        static SharedRAM* allocateRAM(int size) {
+            SharedRAM* shared = new SharedRAM;
+            shared->refs.store(1, std::memory_order_relaxed);
+            shared->data = new uint8_t[size];
+            return shared;
+        }
+
+        static void releaseRAM(SharedRAM* shared) {
+            if (shared && shared->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete[] shared->data;
+                delete shared;
+            }
+        }
+
+        //bank numbers wrap at the real image size, like the unconnected
+        //high address lines on hardware
+        static void updateBanks(CartridgeState& cart) {
+            if (cart.rom) {
+                int romBanks = (cart.romSize + ROM_BANK_SIZE - 1) / ROM_BANK_SIZE;
+                int offset = (cart.romBank % romBanks) * ROM_BANK_SIZE;
+                int window = cart.romSize - offset;
+                cart.romBankBase = cart.rom + offset;
+                cart.romBankWindow = window < ROM_BANK_SIZE ? window : ROM_BANK_SIZE;
+            } else {
+                cart.romBankBase = nullptr;
+                cart.romBankWindow = 0;
+            }
+
+            if (cart.ram && cart.ramEnabled) {
+                int ramBanks = (cart.ramSize + RAM_BANK_SIZE - 1) / RAM_BANK_SIZE;
+                int offset = (cart.ramBank % ramBanks) * RAM_BANK_SIZE;
+                int window = cart.ramSize - offset;
+                cart.ramBankBase = cart.ram + offset;
+                cart.ramBankWindow = window < RAM_BANK_SIZE ? window : RAM_BANK_SIZE;
+            } else {
+                cart.ramBankBase = nullptr;
+                cart.ramBankWindow = 0;
+            }
+        }
+
         void initialize(GBState& state) {
             auto& cart = state.cartridge;
 
+            cart.romBankBase = nullptr;
+            cart.ramBankBase = nullptr;
+            cart.romBankWindow = 0;
+            cart.ramBankWindow = 0;
             cart.rom = nullptr;
+            cart.romImage = nullptr;
             cart.ram = nullptr;
+            cart.ramOwner = nullptr;
+            cart.ramShared = false;
+            cart.ramDirty = nullptr;
             cart.romSize = 0;
             cart.ramSize = 0;
             cart.mapper = MapperType::NONE;
@@ -25,14 +84,22 @@ namespace gb {
         void cleanup(GBState& state) {
             auto& cart = state.cartridge;
 
-            if (cart.rom) {
-                delete[] cart.rom;
+            //the image may still be shared with other instances
+            if (cart.romImage) {
+                romcache::release(cart.romImage);
+                cart.romImage = nullptr;
                 cart.rom = nullptr;
+                cart.romSize = 0;
             }
             if (cart.ram) {
-                delete[] cart.ram;
+                releaseRAM(cart.ramOwner);
+                delete[] cart.ramDirty;
                 cart.ram = nullptr;
+                cart.ramOwner = nullptr;
+                cart.ramShared = false;
+                cart.ramDirty = nullptr;
             }
+            updateBanks(cart);
 
             cart.loaded = false;
         }
@@ -42,18 +109,13 @@ namespace gb {
 
             cleanup(state);
 
-            FILE* file = fopen(filePath, "rb");
-            if (!file) {
+            const romcache::RomImage* image = romcache::acquire(filePath);
+            if (!image) {
                 return false;
             }
-
-            fseek(file, 0, SEEK_END);
-            cart.romSize = ftell(file);
-            fseek(file, 0, SEEK_SET);
-
-            cart.rom = new uint8_t[cart.romSize];
-            fread(cart.rom, 1, cart.romSize, file);
-            fclose(file);
+            cart.romImage = image;
+            cart.rom = image->data;
+            cart.romSize = image->size;
 
             memset(cart.title, 0, sizeof(cart.title));
             for (int i = 0; i < 16; i++) {
@@ -97,8 +159,10 @@ namespace gb {
             }
 
             if (cart.ramSize > 0) {
-                cart.ram = new uint8_t[cart.ramSize];
+                cart.ramOwner = allocateRAM(cart.ramSize);
+                cart.ram = cart.ramOwner->data;
                 memset(cart.ram, 0, cart.ramSize);
+                cart.ramDirty = new uint64_t[CartridgeState::RAM_DIRTY_WORDS]();
             }
 
             cart.romBank = 1;
@@ -106,113 +170,143 @@ namespace gb {
             cart.ramEnabled = false;
             cart.mbcMode = 0;
             cart.loaded = true;
+            updateBanks(cart);
 
             return true;
         }
 
-        uint8_t read(GBState& state, uint16_t address) {
+        template<> void writeControl<MapperType::MBC1>(GBState& state, uint16_t address, uint8_t value) {
             auto& cart = state.cartridge;
 
-            if (!cart.rom) {
-                return 0xFF;
+            if (address < 0x2000) {
+                cart.ramEnabled = ((value & 0x0F) == 0x0A);
+            }
+            else if (address < 0x4000) {
+                int bank = value & 0x1F;
+                if (bank == 0) bank = 1;
+                cart.romBank = (cart.romBank & 0x60) | bank;
+            }
+            else if (address < 0x6000) {
+                if (cart.mbcMode == 0) {
+                    cart.romBank = (cart.romBank & 0x1F) | ((value & 0x03) << 5);
+                } else {
+                    cart.ramBank = value & 0x03;
+                }
             }
+            else if (address < 0x8000) {
+                cart.mbcMode = value & 0x01;
+            }
+
+            updateBanks(cart);
+        }
 
-            if (address < 0x4000) {
-                return cart.rom[address];
+        template<> void writeControl<MapperType::MBC3>(GBState& state, uint16_t address, uint8_t value) {
+            auto& cart = state.cartridge;
+
+            if (address < 0x2000) {
+                cart.ramEnabled = ((value & 0x0F) == 0x0A);
+            }
+            else if (address < 0x4000) {
+                int bank = value & 0x7F;
+                if (bank == 0) bank = 1;
+                cart.romBank = bank;
             }
+            else if (address < 0x6000) {
+                cart.ramBank = value & 0x03;
+            }
+
+            updateBanks(cart);
+        }
 
-            if (address < 0x8000) {
-                int bankOffset = cart.romBank * 0x4000;
-                return cart.rom[bankOffset + (address - 0x4000)];
+        template<> void writeControl<MapperType::MBC5>(GBState& state, uint16_t address, uint8_t value) {
+            auto& cart = state.cartridge;
+
+            if (address < 0x2000) {
+                cart.ramEnabled = ((value & 0x0F) == 0x0A);
+            }
+            else if (address < 0x3000) {
+                cart.romBank = (cart.romBank & 0x100) | value;
+            }
+            else if (address < 0x4000) {
+                cart.romBank = (cart.romBank & 0xFF) | ((value & 0x01) << 8);
+            }
+            else if (address < 0x6000) {
+                cart.ramBank = value & 0x0F;
             }
 
-            return 0xFF;
+            updateBanks(cart);
         }
 
         void write(GBState& state, uint16_t address, uint8_t value) {
+            switch (state.cartridge.mapper) {
+                case MapperType::MBC1: writeControl<MapperType::MBC1>(state, address, value); break;
+                case MapperType::MBC3: writeControl<MapperType::MBC3>(state, address, value); break;
+                case MapperType::MBC5: writeControl<MapperType::MBC5>(state, address, value); break;
+                default: break;
+            }
+        }
+
+        void refreshBanks(GBState& state) {
+            updateBanks(state.cartridge);
+        }
+
+        void unshareRAM(GBState& state) {
             auto& cart = state.cartridge;
 
-            switch (cart.mapper) {
-                case MapperType::MBC1:
-                    if (address < 0x2000) {
-                        cart.ramEnabled = ((value & 0x0F) == 0x0A);
-                    }
-                    else if (address < 0x4000) {
-                        int bank = value & 0x1F;
-                        if (bank == 0) bank = 1;
-                        cart.romBank = (cart.romBank & 0x60) | bank;
-                    }
-                    else if (address < 0x6000) {
-                        if (cart.mbcMode == 0) {
-                            cart.romBank = (cart.romBank & 0x1F) | ((value & 0x03) << 5);
-                        } else {
-                            cart.ramBank = value & 0x03;
-                        }
-                    }
-                    else if (address < 0x8000) {
-                        cart.mbcMode = value & 0x01;
-                    }
-                    break;
+            if (!cart.ramShared) return;
+            cart.ramShared = false;
 
-                case MapperType::MBC3:
-                    if (address < 0x2000) {
-                        cart.ramEnabled = ((value & 0x0F) == 0x0A);
-                    }
-                    else if (address < 0x4000) {
-                        int bank = value & 0x7F;
-                        if (bank == 0) bank = 1;
-                        cart.romBank = bank;
-                    }
-                    else if (address < 0x6000) {
-                        cart.ramBank = value & 0x03;
-                    }
-                    break;
+            //the other holders may be gone already
+            SharedRAM* shared = cart.ramOwner;
+            if (shared->refs.load(std::memory_order_acquire) == 1) return;
 
-                case MapperType::MBC5:
-                    if (address < 0x2000) {
-                        cart.ramEnabled = ((value & 0x0F) == 0x0A);
-                    }
-                    else if (address < 0x3000) {
-                        cart.romBank = (cart.romBank & 0x100) | value;
-                    }
-                    else if (address < 0x4000) {
-                        cart.romBank = (cart.romBank & 0xFF) | ((value & 0x01) << 8);
-                    }
-                    else if (address < 0x6000) {
-                        cart.ramBank = value & 0x0F;
-                    }
-                    break;
+            SharedRAM* own = allocateRAM(cart.ramSize);
+            memcpy(own->data, shared->data, cart.ramSize);
+            releaseRAM(shared);
 
-                default:
-                    break;
-            }
+            cart.ramOwner = own;
+            cart.ram = own->data;
+            updateBanks(cart);
         }
 
-        uint8_t readRAM(GBState& state, uint16_t address) {
-            auto& cart = state.cartridge;
+        size_t share(GBState& target, GBState& source) {
+            auto& cart = target.cartridge;
 
-            if (!cart.ramEnabled || !cart.ram) {
-                return 0xFF;
+            if (cart.romImage) {
+                romcache::retain(cart.romImage);
             }
+            if (!cart.ram) return 0;
 
-            int offset = (cart.ramBank * 0x2000) + (address - 0xA000);
-            if (offset < cart.ramSize) {
-                return cart.ram[offset];
-            }
+            cart.ramOwner->refs.fetch_add(1, std::memory_order_relaxed);
+            cart.ramShared = true;
+            source.cartridge.ramShared = true;
 
-            return 0xFF;
+            cart.ramDirty = new uint64_t[CartridgeState::RAM_DIRTY_WORDS];
+            memcpy(cart.ramDirty, source.cartridge.ramDirty, CartridgeState::RAM_DIRTY_WORDS * sizeof(uint64_t));
+            return CartridgeState::RAM_DIRTY_WORDS * sizeof(uint64_t);
         }
 
-        void writeRAM(GBState& state, uint16_t address, uint8_t value) {
+        bool takeDirtyPages(GBState& state, uint64_t* pages) {
             auto& cart = state.cartridge;
 
-            if (!cart.ramEnabled || !cart.ram) {
-                return;
+            uint64_t any = 0;
+            if (!cart.ramDirty) {
+                memset(pages, 0, CartridgeState::RAM_DIRTY_WORDS * sizeof(uint64_t));
+                return false;
+            }
+            for (int i = 0; i < CartridgeState::RAM_DIRTY_WORDS; i++) {
+                pages[i] = cart.ramDirty[i];
+                any |= cart.ramDirty[i];
+                cart.ramDirty[i] = 0;
             }
+            return any != 0;
+        }
+
+        void markAllDirty(GBState& state) {
+            auto& cart = state.cartridge;
 
-            int offset = (cart.ramBank * 0x2000) + (address - 0xA000);
-            if (offset < cart.ramSize) {
-                cart.ram[offset] = value;
+            if (cart.ramDirty) {
+                memset(cart.ramDirty, 0xFF, CartridgeState::RAM_DIRTY_WORDS * sizeof(uint64_t));
             }
         }
 
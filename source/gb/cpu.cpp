@@ -25,10 +25,11 @@ namespace gb {
         }
 
         // Helper: push word to stack
+        template<MapperType M>
         static inline void pushWord(GBState& state, uint16_t val) {
             state.cpu.SP -= 2;
-            memory::write(state, state.cpu.SP, val & 0xFF);
-            memory::write(state, state.cpu.SP + 1, val >> 8);
+            memory::write<M>(state, state.cpu.SP, val & 0xFF);
+            memory::write<M>(state, state.cpu.SP + 1, val >> 8);
         }
 
         // Helper: pop word from stack
@@ -63,6 +64,7 @@ namespace gb {
         }
 
         // Set 8-bit value to operand
+        template<MapperType M>
         static void setValue8(GBState& state, Operand op, uint8_t val) {
             switch (op) {
                 case Operand::A: state.cpu.A = val; break;
@@ -72,14 +74,14 @@ namespace gb {
                 case Operand::E: state.cpu.E = val; break;
                 case Operand::H: state.cpu.H = val; break;
                 case Operand::L: state.cpu.L = val; break;
-                case Operand::MEM_BC: memory::write(state, state.cpu.BC, val); break;
-                case Operand::MEM_DE: memory::write(state, state.cpu.DE, val); break;
-                case Operand::MEM_HL: memory::write(state, state.cpu.HL, val); break;
-                case Operand::MEM_HL_INC: memory::write(state, state.cpu.HL++, val); break;
-                case Operand::MEM_HL_DEC: memory::write(state, state.cpu.HL--, val); break;
-                case Operand::MEM_NN: memory::write(state, fetchWord(state), val); break;
-                case Operand::MEM_FF_N: memory::write(state, 0xFF00 + fetchByte(state), val); break;
-                case Operand::MEM_FF_C: memory::write(state, 0xFF00 + state.cpu.C, val); break;
+                case Operand::MEM_BC: memory::write<M>(state, state.cpu.BC, val); break;
+                case Operand::MEM_DE: memory::write<M>(state, state.cpu.DE, val); break;
+                case Operand::MEM_HL: memory::write<M>(state, state.cpu.HL, val); break;
+                case Operand::MEM_HL_INC: memory::write<M>(state, state.cpu.HL++, val); break;
+                case Operand::MEM_HL_DEC: memory::write<M>(state, state.cpu.HL--, val); break;
+                case Operand::MEM_NN: memory::write<M>(state, fetchWord(state), val); break;
+                case Operand::MEM_FF_N: memory::write<M>(state, 0xFF00 + fetchByte(state), val); break;
+                case Operand::MEM_FF_C: memory::write<M>(state, 0xFF00 + state.cpu.C, val); break;
                 default: break;
             }
         }
@@ -140,6 +142,7 @@ namespace gb {
         }
 
         // Execute a single opcode entry
+        template<MapperType M>
         static int executeOp(GBState& state, const OpcodeEntry& entry) {
             auto& cpu = state.cpu;
             int cycles = entry.cycles;
@@ -150,13 +153,13 @@ namespace gb {
 
                 case MicroOp::LD8: {
                     uint8_t val = getValue8(state, entry.src);
-                    setValue8(state, entry.dst, val);
+                    setValue8<M>(state, entry.dst, val);
                     break;
                 }
 
                 case MicroOp::ST8: {
                     uint8_t val = getValue8(state, entry.src);
-                    setValue8(state, entry.dst, val);
+                    setValue8<M>(state, entry.dst, val);
                     break;
                 }
 
@@ -168,8 +171,8 @@ namespace gb {
 
                 case MicroOp::ST16: {
                     uint16_t addr = fetchWord(state);
-                    memory::write(state, addr, cpu.SP & 0xFF);
-                    memory::write(state, addr + 1, cpu.SP >> 8);
+                    memory::write<M>(state, addr, cpu.SP & 0xFF);
+                    memory::write<M>(state, addr + 1, cpu.SP >> 8);
                     break;
                 }
 
@@ -216,7 +219,7 @@ namespace gb {
                     uint8_t result = val + 1;
                     cpu.F = (cpu.F & FLAG_C) | (result == 0 ? FLAG_Z : 0) |
                             ((val & 0x0F) == 0x0F ? FLAG_H : 0);
-                    setValue8(state, entry.dst, result);
+                    setValue8<M>(state, entry.dst, result);
                     break;
                 }
 
@@ -225,7 +228,7 @@ namespace gb {
                     uint8_t result = val - 1;
                     cpu.F = (cpu.F & FLAG_C) | (result == 0 ? FLAG_Z : 0) | FLAG_N |
                             ((val & 0x0F) == 0x00 ? FLAG_H : 0);
-                    setValue8(state, entry.dst, result);
+                    setValue8<M>(state, entry.dst, result);
                     break;
                 }
 
@@ -328,7 +331,7 @@ namespace gb {
                     uint8_t val = getValue8(state, entry.dst);
                     uint8_t result = (val << 1) | (val >> 7);
                     setFlags(state, result == 0, false, false, val & 0x80);
-                    setValue8(state, entry.dst, result);
+                    setValue8<M>(state, entry.dst, result);
                     break;
                 }
 
@@ -336,7 +339,7 @@ namespace gb {
                     uint8_t val = getValue8(state, entry.dst);
                     uint8_t result = (val >> 1) | (val << 7);
                     setFlags(state, result == 0, false, false, val & 0x01);
-                    setValue8(state, entry.dst, result);
+                    setValue8<M>(state, entry.dst, result);
                     break;
                 }
 
@@ -345,7 +348,7 @@ namespace gb {
                     uint8_t carry = (cpu.F & FLAG_C) ? 1 : 0;
                     uint8_t result = (val << 1) | carry;
                     setFlags(state, result == 0, false, false, val & 0x80);
-                    setValue8(state, entry.dst, result);
+                    setValue8<M>(state, entry.dst, result);
                     break;
                 }
 
@@ -354,7 +357,7 @@ namespace gb {
                     uint8_t carry = (cpu.F & FLAG_C) ? 0x80 : 0;
                     uint8_t result = (val >> 1) | carry;
                     setFlags(state, result == 0, false, false, val & 0x01);
-                    setValue8(state, entry.dst, result);
+                    setValue8<M>(state, entry.dst, result);
                     break;
                 }
 
@@ -362,7 +365,7 @@ namespace gb {
                     uint8_t val = getValue8(state, entry.dst);
                     uint8_t result = val << 1;
                     setFlags(state, result == 0, false, false, val & 0x80);
-                    setValue8(state, entry.dst, result);
+                    setValue8<M>(state, entry.dst, result);
                     break;
                 }
 
@@ -370,7 +373,7 @@ namespace gb {
                     uint8_t val = getValue8(state, entry.dst);
                     uint8_t result = (val >> 1) | (val & 0x80);
                     setFlags(state, result == 0, false, false, val & 0x01);
-                    setValue8(state, entry.dst, result);
+                    setValue8<M>(state, entry.dst, result);
                     break;
                 }
 
@@ -378,7 +381,7 @@ namespace gb {
                     uint8_t val = getValue8(state, entry.dst);
                     uint8_t result = val >> 1;
                     setFlags(state, result == 0, false, false, val & 0x01);
-                    setValue8(state, entry.dst, result);
+                    setValue8<M>(state, entry.dst, result);
                     break;
                 }
 
@@ -386,7 +389,7 @@ namespace gb {
                     uint8_t val = getValue8(state, entry.dst);
                     uint8_t result = ((val & 0x0F) << 4) | ((val & 0xF0) >> 4);
                     setFlags(state, result == 0, false, false, false);
-                    setValue8(state, entry.dst, result);
+                    setValue8<M>(state, entry.dst, result);
                     break;
                 }
 
@@ -400,14 +403,14 @@ namespace gb {
                 case MicroOp::RES: {
                     uint8_t val = getValue8(state, entry.src);
                     uint8_t bit = getBitIndex(entry.dst);
-                    setValue8(state, entry.src, val & ~(1 << bit));
+                    setValue8<M>(state, entry.src, val & ~(1 << bit));
                     break;
                 }
 
                 case MicroOp::SET: {
                     uint8_t val = getValue8(state, entry.src);
                     uint8_t bit = getBitIndex(entry.dst);
-                    setValue8(state, entry.src, val | (1 << bit));
+                    setValue8<M>(state, entry.src, val | (1 << bit));
                     break;
                 }
 
@@ -509,7 +512,7 @@ namespace gb {
 
                 case MicroOp::CALL: {
                     uint16_t addr = fetchWord(state);
-                    pushWord(state, cpu.PC);
+                    pushWord<M>(state, cpu.PC);
                     cpu.PC = addr;
                     break;
                 }
@@ -517,7 +520,7 @@ namespace gb {
                 case MicroOp::CALL_Z: {
                     uint16_t addr = fetchWord(state);
                     if (cpu.F & FLAG_Z) {
-                        pushWord(state, cpu.PC);
+                        pushWord<M>(state, cpu.PC);
                         cpu.PC = addr;
                     } else {
                         cycles = entry.cyclesBranch;
@@ -528,7 +531,7 @@ namespace gb {
                 case MicroOp::CALL_NZ: {
                     uint16_t addr = fetchWord(state);
                     if (!(cpu.F & FLAG_Z)) {
-                        pushWord(state, cpu.PC);
+                        pushWord<M>(state, cpu.PC);
                         cpu.PC = addr;
                     } else {
                         cycles = entry.cyclesBranch;
@@ -539,7 +542,7 @@ namespace gb {
                 case MicroOp::CALL_C: {
                     uint16_t addr = fetchWord(state);
                     if (cpu.F & FLAG_C) {
-                        pushWord(state, cpu.PC);
+                        pushWord<M>(state, cpu.PC);
                         cpu.PC = addr;
                     } else {
                         cycles = entry.cyclesBranch;
@@ -550,7 +553,7 @@ namespace gb {
                 case MicroOp::CALL_NC: {
                     uint16_t addr = fetchWord(state);
                     if (!(cpu.F & FLAG_C)) {
-                        pushWord(state, cpu.PC);
+                        pushWord<M>(state, cpu.PC);
                         cpu.PC = addr;
                     } else {
                         cycles = entry.cyclesBranch;
@@ -606,13 +609,13 @@ namespace gb {
                 }
 
                 case MicroOp::RST: {
-                    pushWord(state, cpu.PC);
+                    pushWord<M>(state, cpu.PC);
                     cpu.PC = getRSTVector(entry.dst);
                     break;
                 }
 
                 case MicroOp::PUSH: {
-                    pushWord(state, getValue16(state, entry.dst));
+                    pushWord<M>(state, getValue16(state, entry.dst));
                     break;
                 }
 
@@ -676,7 +679,7 @@ namespace gb {
                 case MicroOp::CB: {
                     uint8_t cbOpcode = fetchByte(state);
                     const OpcodeEntry& cbEntry = state.opcodes.cb[cbOpcode];
-                    return executeOp(state, cbEntry);
+                    return executeOp<M>(state, cbEntry);
                 }
 
                 default:
@@ -700,9 +703,19 @@ namespace gb {
             cpu.halted = false;
             cpu.ime = false;
             cpu.imeScheduled = false;
+            cpu.interruptPending = false;
+
+            //the cpu drives the scheduler clock
+            state.scheduler.cycles = 0;
+            state.scheduler.timerDeadline = SchedulerState::NO_DEADLINE;
+            state.scheduler.ppuDeadline = SchedulerState::NO_DEADLINE;
+            //syncMode is host configuration, it stays across resets
         }
 
-        int step(GBState& state) {
+        //one instantiation per mapper, so the MBC dispatch on writes is
+        //resolved at compile time (selected once per rom, see stepFor)
+        template<MapperType M>
+        static int stepAs(GBState& state) {
             auto& cpu = state.cpu;
 
             if (cpu.imeScheduled) {
@@ -717,8 +730,17 @@ namespace gb {
             uint8_t opcode = fetchByte(state);
             const OpcodeEntry& entry = state.opcodes.main[opcode];
             
-            return executeOp(state, entry);
+            return executeOp<M>(state, entry);
+        }
+
+        StepFunction stepFor(MapperType mapper) {
+            switch (mapper) {
+                case MapperType::MBC1: return stepAs<MapperType::MBC1>;
+                case MapperType::MBC3: return stepAs<MapperType::MBC3>;
+                case MapperType::MBC5: return stepAs<MapperType::MBC5>;
+                default: return stepAs<MapperType::NONE>;
+            }
         }
 
     }
-}
\ No newline at end of file
+}
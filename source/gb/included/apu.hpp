@@ -6,24 +6,59 @@
 namespace gb {
 
     struct GBState;
+    enum class AudioSynthesis : uint8_t;
+    enum class AudioMode : uint8_t;
 
     namespace apu {
 
-        constexpr int SAMPLE_RATE = 32768;
+        constexpr int SAMPLE_RATE = 32768; //native point sampled rate and default output rate
+        constexpr int MIN_SAMPLE_RATE = 8000;
+        constexpr int MAX_SAMPLE_RATE = 96000;
         constexpr int CYCLES_PER_SAMPLE = 128;
         constexpr int BUFFER_SIZE = 2048;
+        constexpr int CYCLES_PER_FRAME = 70224; //blip frames are closed exactly when they reach this length
+        constexpr int CATCH_UP_CHUNK = 8192; //largest single tick catchUp hands over
 
         extern const uint8_t dutyPatterns[4];
 
+        constexpr int LFSR15_PERIOD = 32767;
+        constexpr int LFSR7_PERIOD = 127;
+
+        void buildLFSRTables(); //call to build the noise sequence tables
+
         void initialize(GBState& state);
         void tick(GBState& state, int cycles);
+
+        //tick up to the scheduler clock; register accesses and the end of
+        //the frame call this, so in catch up mode nothing else has to
+        void catchUp(GBState& state);
         void tickFrameSequencer(GBState& state);
         void generateSample(GBState& state);
 
-        void tickChannel1(GBState& state);
-        void tickChannel2(GBState& state);
-        void tickChannel3(GBState& state);
-        void tickChannel4(GBState& state);
+        //band limited path: resample the finished frame into the audio buffer
+        void endFrame(GBState& state);
+        void setSynthesis(GBState& state, AudioSynthesis synthesis);
+        void setMode(GBState& state, AudioMode mode);
+
+        //per instance output rate (e.g. 22050 / 44100 / 48000)
+        void setSampleRate(GBState& state, int sampleRate);
+
+        //point sampled block mode: mix the collected block with simd
+        void mixBlock(GBState& state);
+        void setBlockMixing(GBState& state, bool enabled);
+
+        //closed form advance of a channel by any number of cycles
+        //(duty position, wave position, lfsr steps), no output produced
+        void advanceChannel1(GBState& state, int cycles);
+        void advanceChannel2(GBState& state, int cycles);
+        void advanceChannel3(GBState& state, int cycles);
+        void advanceChannel4(GBState& state, int cycles);
+
+        //band limited: run all channels over cycles, emitting their edges
+        void runChannels(GBState& state, int cycles);
+
+        //rebuild channel 3's decoded wave table from wave ram and NR32
+        void rebuildWaveTable(GBState& state);
 
         void writeRegister(GBState& state, uint8_t reg, uint8_t value);
         uint8_t readRegister(GBState& state, uint8_t reg);
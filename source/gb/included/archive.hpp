@@ -0,0 +1,28 @@
+#ifndef GB_ARCHIVE_HPP
+#define GB_ARCHIVE_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+namespace gb {
+
+    //compressed rom containers: gzip, and zip with stored or deflated entries
+    namespace archive {
+
+        enum class Format : uint8_t {
+            RAW, //not an archive, used as is
+            GZIP,
+            ZIP
+        };
+
+        Format detect(const uint8_t* data, size_t size);
+
+        //decompresses the rom into a new[] buffer of exactly its size; for zip
+        //the first .gb / .gbc / .sgb entry is taken, else the first file.
+        //fails on damaged archives, crc mismatches and images over maxSize
+        bool extract(const uint8_t* data, size_t size, int maxSize, uint8_t*& image, int& imageSize);
+
+    }
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef GB_BLIP_BUFFER_HPP
+#define GB_BLIP_BUFFER_HPP
+
+#include <cstdint>
+#include "state.hpp"
+
+namespace gb {
+
+    //band limited step synthesis
+    //channels add an amplitude delta at the clock it happens, the delta is
+    //spread over a few output samples with a windowed sinc kernel and the
+    //buffer is integrated back into pcm once per frame
+    namespace blip {
+
+        constexpr int CLOCK_RATE = 4194304; //gb master clock, 1 << 22
+        constexpr int FRAC_BITS = 16; //fractional bits of a sample position
+        constexpr int CLOCK_SHIFT = 22 - FRAC_BITS; //clock * rate >> shift = fixed position
+        constexpr int PHASE_BITS = 5;
+        constexpr int PHASES = 1 << PHASE_BITS;
+        constexpr int KERNEL_TAPS = BlipState::KERNEL_TAPS;
+        constexpr int KERNEL_BITS = 13; //every kernel phase sums to 1 << KERNEL_BITS
+
+        //kernel[phase][tap], shared by every instance
+        extern int16_t kernel[PHASES][KERNEL_TAPS];
+
+        void buildKernel(); //call to build the kernel table
+
+        //windowed sinc lowpass, cutoff as a fraction of nyquist; every phase
+        //sums to 1 << KERNEL_BITS (also used by the resampler)
+        void designKernel(int16_t (*table)[KERNEL_TAPS], double cutoff);
+
+        void initialize(BlipState& blip, int sampleRate);
+        void clear(BlipState& blip);
+
+        //add an amplitude change at clock time (relative to the frame start)
+        void addDelta(BlipState& blip, uint32_t time, int delta);
+
+        //close the frame after clocks cycles, the samples before it are final
+        void endFrame(BlipState& blip, uint32_t clocks);
+
+        int samplesAvailable(const BlipState& blip);
+
+        //integrate up to count samples into out (stride apart, null = discard)
+        int readSamples(BlipState& blip, int16_t* out, int count, int stride);
+
+    }
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef GB_BUFFERS_HPP
+#define GB_BUFFERS_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+namespace gb {
+
+    struct GBState;
+
+    //video and audio output buffers; inline in GBState by default, heap
+    //allocated on first use in GB_COMPACT_STATE builds so headless
+    //instances only pay for what they read
+    namespace buffers {
+
+        //once per state before anything else, binds or clears the pointers
+        void initialize(GBState& state);
+        void cleanup(GBState& state);
+
+        //a detached ppu skips rendering, a detached apu behaves as register
+        //only, in both build modes; detach only frees anything in compact
+        //builds, inline buffers are just unbound
+        bool attachVideo(GBState& state);
+        void detachVideo(GBState& state);
+        bool attachAudio(GBState& state);
+        void detachAudio(GBState& state);
+
+        bool hasVideo(const GBState& state);
+        bool hasAudio(const GBState& state);
+
+        //target has just been assigned a copy of source: binds it to buffers
+        //of its own holding the same contents; returns the bytes copied
+        //beyond the assignment (heap buffers in compact builds)
+        size_t copy(GBState& target, const GBState& source);
+
+        //bytes allocated outside GBState
+        size_t heapBytes(const GBState& state);
+
+    }
+}
+
+#endif
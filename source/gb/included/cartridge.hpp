@@ -2,6 +2,8 @@
 #define GB_CARTRIDGE_HPP
 
 #include <cstdint>
+#include <cstddef>
+#include "state.hpp"
 
 namespace gb {
 
@@ -13,11 +15,78 @@ namespace gb {
         bool loadRom(GBState& state, const char* filePath);
         void cleanup(GBState& state);
 
-        uint8_t read(GBState& state, uint16_t address);
+        //any mapper, switches on cart.mapper
         void write(GBState& state, uint16_t address, uint8_t value);
 
-        uint8_t readRAM(GBState& state, uint16_t address);
-        void writeRAM(GBState& state, uint16_t address, uint8_t value);
+        //MBC register writes for one mapper, used by the mapper specialized
+        //core so the mapper switch is resolved at compile time
+        template<MapperType M> void writeControl(GBState& state, uint16_t address, uint8_t value);
+
+        //no MBC: rom area writes are ignored
+        template<> inline void writeControl<MapperType::NONE>(GBState&, uint16_t, uint8_t) {}
+        template<> void writeControl<MapperType::MBC1>(GBState& state, uint16_t address, uint8_t value);
+        template<> void writeControl<MapperType::MBC3>(GBState& state, uint16_t address, uint8_t value);
+        template<> void writeControl<MapperType::MBC5>(GBState& state, uint16_t address, uint8_t value);
+
+        //reads go through the cached bank bases and are the same for every mapper
+        inline uint8_t read(GBState& state, uint16_t address) {
+            auto& cart = state.cartridge;
+
+            if (address < 0x4000) {
+                return address < cart.romSize ? cart.rom[address] : 0xFF;
+            }
+
+            //a mapped image ends at the file, past it would fault
+            int offset = address - 0x4000;
+            if (offset < cart.romBankWindow) {
+                return cart.romBankBase[offset];
+            }
+
+            return 0xFF;
+        }
+
+        inline uint8_t readRAM(GBState& state, uint16_t address) {
+            auto& cart = state.cartridge;
+
+            int offset = address - 0xA000;
+            if (offset < cart.ramBankWindow) {
+                return cart.ramBankBase[offset];
+            }
+
+            return 0xFF;
+        }
+
+        //gives this state its own copy of a sram shared with clones; a no-op
+        //once it is the only holder. Anything writing cart.ram directly calls it first
+        void unshareRAM(GBState& state);
+
+        inline void writeRAM(GBState& state, uint16_t address, uint8_t value) {
+            auto& cart = state.cartridge;
+
+            int offset = address - 0xA000;
+            if (offset < cart.ramBankWindow) {
+                if (cart.ramShared) unshareRAM(state);
+                cart.ramBankBase[offset] = value;
+
+                int page = (int)(cart.ramBankBase - cart.ram + offset) / CartridgeState::RAM_PAGE_SIZE;
+                cart.ramDirty[page >> 6] |= 1ull << (page & 63);
+            }
+        }
+
+        //recomputes the bank bases from the bank registers, for code that
+        //restores them directly (save states)
+        void refreshBanks(GBState& state);
+
+        //target has just been assigned a copy of source: takes its own
+        //reference on the rom image, shares the sram copy on write and gives
+        //it its own dirty page bitmap; returns the bytes copied
+        size_t share(GBState& target, GBState& source);
+
+        //copies the dirty page bitmap out (RAM_DIRTY_WORDS words) and clears
+        //it; false when no page was written
+        bool takeDirtyPages(GBState& state, uint64_t* pages);
+        //for code replacing the whole sram at once (sram files, save states)
+        void markAllDirty(GBState& state);
 
         const char* getTitle(GBState& state);
 
@@ -6,6 +6,7 @@
 namespace gb {
 
     struct GBState;
+    enum class MapperType : uint8_t;
 
     namespace cpu {
 
@@ -15,9 +16,11 @@ namespace gb {
         constexpr uint8_t FLAG_H = 0x20;
         constexpr uint8_t FLAG_C = 0x10;
 
+        typedef int (*StepFunction)(GBState& state);
+
         // Functions
         void initialize(GBState& state);
-        int step(GBState& state);
+        StepFunction stepFor(MapperType mapper); //specialized for one mapper, resolve once per rom
         int executeCB(GBState& state);
     }
 }
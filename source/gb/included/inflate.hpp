@@ -0,0 +1,25 @@
+#ifndef GB_INFLATE_HPP
+#define GB_INFLATE_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+namespace gb {
+
+    //raw deflate (RFC 1951) decoder, single pass from the compressed bytes
+    //straight into the caller's output; the output doubles as the window
+    namespace inflate {
+
+        //decodes the whole stream into out; fails on malformed or truncated
+        //input and on output that would not fit in outSize. consumed / written
+        //report how much of each side was used (either may be nullptr)
+        bool decode(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize,
+                    size_t* consumed, size_t* written);
+
+        //crc-32 as used by gzip and zip, continuing from crc (0 to start)
+        uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0);
+
+    }
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef GB_LAYOUT_HPP
+#define GB_LAYOUT_HPP
+
+#include <cstddef>
+
+namespace gb {
+
+    namespace layout {
+
+        constexpr size_t CACHE_LINE = 64;
+
+        //registers, scheduler deadlines, timer and bank pointers
+        constexpr size_t HOT_HEAD_BYTES = 2 * CACHE_LINE;
+
+        //plus io, hram and ie
+        constexpr size_t HOT_BYTES = 8 * CACHE_LINE;
+
+        //GB_COMPACT_STATE: everything an idle headless instance carries in
+        //GBState; video (23 KB) and audio (24 KB) buffers come on top only
+        //once attached, the rom and sram on top of that are per cartridge
+        constexpr size_t COMPACT_STATE_BUDGET = 24 * 1024;
+
+        struct Entry {
+            const char* name;
+            size_t offset;
+            size_t size;
+        };
+
+        //one entry per top level GBState member, in memory order
+        int entries(const Entry*& out);
+
+        //human readable offset / size / cache line table, returns the length
+        //written (snprintf style, truncated to size)
+        int report(char* buffer, size_t size);
+
+    }
+}
+
+#endif
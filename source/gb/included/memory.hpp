@@ -3,6 +3,7 @@
 
 #include <cstdint>
 #include "state.hpp" 
+#include "cartridge.hpp"
 
 namespace gb {
 
@@ -34,9 +35,154 @@ namespace gb {
         void initialize(GBState& state);
         void doDMA(GBState& state, uint8_t value);
 
-        //full read / write with all edge cases
-        uint8_t read(GBState& state, uint16_t address);
+        //IO dispatch: subsystems claim their registers (and any sync they
+        //need before an access) here; nullptr keeps plain io[] storage
+        void registerIO(GBState& state, uint8_t reg, IOReadHandler read, IOWriteHandler write);
+        void registerIORange(GBState& state, uint8_t first, uint8_t last, IOReadHandler read, IOWriteHandler write);
+
+        //full read / write with all edge cases; the untemplated write
+        //switches on the mapper, the core uses write<M> (defined below)
+        inline uint8_t read(GBState& state, uint16_t address);
         void write(GBState& state, uint16_t address, uint8_t value);
+        template<MapperType M> inline void write(GBState& state, uint16_t address, uint8_t value);
+
+        //IF / IE changes must go through these so cpu.interruptPending stays
+        //current, the dispatch and halt wake up only test that flag
+        inline void updateInterruptPending(GBState& state) {
+            state.cpu.interruptPending = (state.memory.io[IO_IF] & state.memory.ie & 0x1F) != 0;
+        }
+
+        inline void requestInterrupt(GBState& state, uint8_t bit) {
+            state.memory.io[IO_IF] |= bit;
+            updateInterruptPending(state);
+        }
+
+        inline void clearInterrupt(GBState& state, uint8_t bit) {
+            state.memory.io[IO_IF] &= ~bit;
+            updateInterruptPending(state);
+        }
+
+        inline uint8_t read(GBState& state, uint16_t address) {
+            auto& mem = state.memory;
+
+            // ROM
+            if (address < 0x8000) {
+                return cartridge::read(state, address);
+            }
+
+            // VRAM
+            if (address < 0xA000) {
+                return mem.vram[address - 0x8000];
+            }
+
+            // External RAM (cartridge)
+            if (address < 0xC000) {
+                return cartridge::readRAM(state, address);
+            }
+
+            // Work RAM
+            if (address < 0xE000) {
+                return mem.wram[address - 0xC000];
+            }
+
+            // Echo RAM
+            if (address < 0xFE00) {
+                return mem.wram[address - 0xE000];
+            }
+
+            // OAM
+            if (address < 0xFEA0) {
+                return mem.oam[address - 0xFE00];
+            }
+
+            // Unusable
+            if (address < 0xFF00) {
+                return 0xFF;
+            }
+
+            // IO registers
+            if (address < 0xFF80) {
+                uint8_t reg = address - 0xFF00;
+                IOReadHandler handler = mem.ioRead[reg];
+                return handler ? handler(state, reg) : mem.io[reg];
+            }
+
+            // High RAM
+            if (address < 0xFFFF) {
+                return mem.hram[address - 0xFF80];
+            }
+
+            // Interrupt Enable
+            return mem.ie;
+        }
+
+        template<MapperType M>
+        inline void write(GBState& state, uint16_t address, uint8_t value) {
+            auto& mem = state.memory;
+
+            // ROM (MBC registers, nothing for MapperType::NONE)
+            if (address < 0x8000) {
+                cartridge::writeControl<M>(state, address, value);
+                return;
+            }
+
+            // VRAM
+            if (address < 0xA000) {
+                mem.vram[address - 0x8000] = value;
+                return;
+            }
+
+            // External RAM
+            if (address < 0xC000) {
+                cartridge::writeRAM(state, address, value);
+                return;
+            }
+
+            // Work RAM
+            if (address < 0xE000) {
+                mem.wram[address - 0xC000] = value;
+                return;
+            }
+
+            // Echo RAM
+            if (address < 0xFE00) {
+                mem.wram[address - 0xE000] = value;
+                return;
+            }
+
+            // OAM
+            if (address < 0xFEA0) {
+                mem.oam[address - 0xFE00] = value;
+                return;
+            }
+
+            // Unusable
+            if (address < 0xFF00) {
+                return;
+            }
+
+            // IO registers
+            if (address < 0xFF80) {
+                uint8_t reg = address - 0xFF00;
+                IOWriteHandler handler = mem.ioWrite[reg];
+                if (handler) {
+                    handler(state, reg, value);
+                } else {
+                    mem.io[reg] = value;
+                }
+                return;
+            }
+
+            // High RAM
+            if (address < 0xFFFF) {
+                mem.hram[address - 0xFF80] = value;
+                return;
+            }
+
+            // Interrupt Enable
+            mem.ie = value;
+            updateInterruptPending(state);
+        }
 
         //fast inline reads for hot paths
         inline uint8_t readVRAM(GBState& state, uint16_t addr){
@@ -34,6 +34,23 @@ namespace gb {
         void initialize(GBState& state);
         void tick(GBState& state, int cycles);
 
+        //tick by however far the scheduler clock has moved since the last call
+        void catchUp(GBState& state);
+
+        //event driven mode: tick only does work when the next mode transition
+        //is due, vblank lines are retired in bulk and caught up by sync()
+        //whenever the cpu touches LY / STAT
+        void advanceMode(GBState& state);
+        void scheduleNextEvent(GBState& state);
+        void sync(GBState& state);
+        void setEventDriven(GBState& state, bool enabled);
+
+        //LY / STAT reads sync first
+        uint8_t readRegister(GBState& state, uint8_t reg);
+
+        //LCDC / STAT / LYC writes, these can move the next event
+        void writeRegister(GBState& state, uint8_t reg, uint8_t value);
+
         void renderScanline(GBState& state);
         void renderBackground(GBState& state);
         void renderWindow(GBState& state);
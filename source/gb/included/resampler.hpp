@@ -0,0 +1,23 @@
+#ifndef GB_RESAMPLER_HPP
+#define GB_RESAMPLER_HPP
+
+#include <cstdint>
+#include "state.hpp"
+
+namespace gb {
+
+    //fixed point polyphase resampler for the point sampled path
+    //(the band limited path resamples inside the blip buffers)
+    namespace resampler {
+
+        void configure(ResamplerState& rs, int inputRate, int outputRate);
+        void reset(ResamplerState& rs);
+
+        //feed count stereo frames, writes at most space frames to out and
+        //returns how many were written; input is always consumed
+        int process(ResamplerState& rs, const int16_t* in, int count, int16_t* out, int space);
+
+    }
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef GB_ROM_CACHE_HPP
+#define GB_ROM_CACHE_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+namespace gb {
+
+    //process wide registry of immutable rom images keyed by content hash;
+    //every instance loading the same rom (under any path) shares one image.
+    //A raw rom file is mapped rather than copied where mmap is available, that
+    //image is shared only with loads of the same file: the file must not be
+    //modified or truncated while an instance uses it
+    namespace romcache {
+
+        enum class Backing : uint8_t {
+            HEAP, //private buffered copy
+            FILE_MAP, //read only mapping of the rom file itself, never shared by content
+            SHARED_MEMORY //inflated archive in a named shm object shared with other processes
+        };
+
+        struct RomImage {
+            const uint8_t* data;
+            int size;
+            uint64_t hash;
+            Backing backing;
+            int refs;
+            bool ownsSharedName; //this process created the shm object
+            uint64_t sharedKey; //its name, from the archive file's identity
+            RomImage* next;
+        };
+
+        //smallest image that still has a complete header
+        constexpr int MIN_ROM_SIZE = 0x150;
+
+        //returns a referenced image, nullptr on failure; a file already in
+        //the registry (same device / inode / size / mtime) is found without
+        //touching its contents. gzip and zip files are decompressed once,
+        //later loads of the same archive (by archive hash) reuse the image
+        const RomImage* acquire(const char* filePath);
+        //one more reference on an image already held (clones)
+        void retain(const RomImage* image);
+        void release(const RomImage* image);
+
+        //cross process sharing through named shared memory (POSIX hosts only,
+        //off by default): an inflated archive is published under the identity
+        //of its file, other processes find it with a stat and map it. Raw roms
+        //are mapped from the file itself either way. Images already loaded
+        //are not converted
+        void setSharedMemory(bool enabled);
+        bool isSharedMemory();
+
+        //content hash used as the registry key
+        uint64_t hash(const uint8_t* data, size_t size);
+
+        //distinct images currently held and their total size, counted once
+        int imageCount();
+        size_t imageBytes();
+
+    }
+}
+
+#endif
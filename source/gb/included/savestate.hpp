@@ -0,0 +1,43 @@
+#ifndef GB_SAVESTATE_HPP
+#define GB_SAVESTATE_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+namespace gb {
+
+    struct GBState;
+
+    //binary snapshots of the whole machine into caller memory, no allocation
+    //the format is a fixed header followed by the subsystem states in a fixed
+    //order, written field by field (little endian, declared widths) from the
+    //field lists in savestate.cpp, so it does not follow struct layout and
+    //moves between builds and hosts; states of another version (or for a
+    //different rom) are refused. Pointers are never stored, load keeps the
+    //target's own (rom, sram, buffers, io handlers), as is its configuration
+    //(sync mode, ppu event mode, audio mode / synthesis / rate, block mixing)
+    namespace savestate {
+
+        //bump with any change to the field lists
+        constexpr uint32_t VERSION = 3;
+
+        //outputs: also store the framebuffer and the pending audio (samples
+        //and blip deltas) of the attached buffers; without them a state is a
+        //fraction of the size but a load leaves the picture as it was and
+        //starts the audio output empty (rewind snapshots)
+
+        //exact bytes save needs for this state (depends on sram size and on
+        //which output buffers are attached and stored)
+        size_t size(const GBState& state, bool outputs = true);
+
+        //returns the bytes written, 0 if capacity is too small or no rom is loaded
+        size_t save(const GBState& state, uint8_t* buffer, size_t capacity, bool outputs = true);
+
+        //false (and state untouched) on a bad header, a version / rom /
+        //sram size mismatch or a truncated buffer
+        bool load(GBState& state, const uint8_t* buffer, size_t size);
+
+    }
+}
+
+#endif
@@ -32,79 +32,123 @@ namespace gb {
         bool ime;
         bool imeScheduled;
         bool halted;
+        bool interruptPending; //IF & IE & 0x1F != 0, kept current on every IF / IE change
     };
 
     // PPU state
     struct PPUState {
-        uint8_t framebuffer[160 * 144];
+        uint8_t* framebuffer; //VideoBuffers, nullptr while video is detached
         bool frameReady;
         int scanlineCycles;
+        int nextEventCycles; //scanlineCycles value of the next mode transition
+        uint64_t lastSync; //scheduler cycle scanlineCycles is current for
+        bool eventDriven; //batch vblank lines instead of stepping them one by one
+        uint32_t skippedTicks; //tick calls that returned before the mode switch
     };
 
     // APU channel states
     struct Channel1State {
         bool enabled;
-        int frequency;
+        uint16_t frequency;
         int frequencyTimer;
-        int dutyPosition;
-        int duty;
-        int volume;
-        int envelopeTimer;
-        int envelopePeriod;
+        uint8_t dutyPosition;
+        uint8_t duty;
+        uint8_t volume;
+        int8_t envelopeTimer;
+        uint8_t envelopePeriod;
         bool envelopeIncrease;
-        int sweepTimer;
-        int sweepPeriod;
+        int8_t sweepTimer;
+        uint8_t sweepPeriod;
         bool sweepNegate;
-        int sweepShift;
-        int shadowFrequency;
-        int lengthCounter;
+        uint8_t sweepShift;
+        uint16_t shadowFrequency;
+        int16_t lengthCounter;
     };
 
     struct Channel2State {
         bool enabled;
-        int frequency;
+        uint16_t frequency;
         int frequencyTimer;
-        int dutyPosition;
-        int duty;
-        int volume;
-        int envelopeTimer;
-        int envelopePeriod;
+        uint8_t dutyPosition;
+        uint8_t duty;
+        uint8_t volume;
+        int8_t envelopeTimer;
+        uint8_t envelopePeriod;
         bool envelopeIncrease;
-        int lengthCounter;
+        int16_t lengthCounter;
     };
 
     struct Channel3State {
         bool enabled;
         bool dacEnabled;
-        int frequency;
+        uint16_t frequency;
         int frequencyTimer;
-        int position;
-        int volume;
-        int lengthCounter;
+        uint8_t position;
+        uint8_t volume;
+        int16_t lengthCounter;
+        int8_t waveTable[32]; //wave ram decoded, volume shifted and centered
     };
 
     struct Channel4State {
         bool enabled;
-        int volume;
-        int envelopeTimer;
-        int envelopePeriod;
+        uint8_t volume;
+        int8_t envelopeTimer;
+        uint8_t envelopePeriod;
         bool envelopeIncrease;
         int frequencyTimer;
-        int divisor;
-        int shiftAmount;
+        uint8_t divisor;
+        uint8_t shiftAmount;
         bool widthMode;
         uint16_t lfsr;
-        int lengthCounter;
+        int16_t lengthCounter;
+    };
+
+    // Band limited synthesis buffer (one per output channel)
+    struct BlipState {
+        static constexpr int BUFFER_SIZE = 2048;
+        static constexpr int KERNEL_TAPS = 8;
+        static constexpr int DELTA_COUNT = BUFFER_SIZE + KERNEL_TAPS;
+        int32_t* deltas; //DELTA_COUNT entries in AudioBuffers, nullptr while audio is detached
+        uint32_t offset; //16.16 sample position of the current frame start
+        int sampleRate;
+        int32_t integrator;
+    };
+
+    // Polyphase resampler from the native point sampled rate to the output rate
+    struct ResamplerState {
+        static constexpr int TAPS = BlipState::KERNEL_TAPS;
+        static constexpr int PHASES = 32;
+        int16_t kernel[PHASES][TAPS]; //per instance, the cutoff follows the ratio
+        int16_t history[TAPS * 2]; //last TAPS stereo input frames
+        uint32_t position; //16.16 time of the next output inside the history
+        uint32_t step; //input frames per output frame, 16.16
+        int inputRate;
+        int outputRate;
+    };
+
+    enum class AudioSynthesis : uint8_t {
+        POINT,      //mix all channels every CYCLES_PER_SAMPLE cycles
+        BANDLIMITED //channels emit deltas into the blip buffers on change
+    };
+
+    enum class AudioMode : uint8_t {
+        FULL,          //synthesize samples
+        REGISTER_ONLY, //frame sequencer only: NR52 status, lengths, envelopes, sweep
+        OFF            //apu is not ticked at all
     };
 
     struct APUState {
         static constexpr int BUFFER_SIZE = 2048;
-        int16_t audioBuffer[BUFFER_SIZE * 2];
+        int16_t* audioBuffer; //AudioBuffers, nullptr while audio is detached
         int bufferPosition;
 
         int sampleCycles;
         int frameSequencerCycles;
-        int frameSequencerStep;
+        uint8_t frameSequencerStep;
+
+        AudioMode mode;
+        AudioSynthesis synthesis;
+        uint64_t lastSync; //scheduler cycle the channels have been run up to
 
         Channel1State ch1;
         Channel2State ch2;
@@ -112,19 +156,59 @@ namespace gb {
         Channel4State ch4;
 
         bool masterEnable;
-        int masterVolumeLeft;
-        int masterVolumeRight;
+        uint8_t masterVolumeLeft;
+        uint8_t masterVolumeRight;
 
         bool ch1Left, ch1Right;
         bool ch2Left, ch2Right;
         bool ch3Left, ch3Right;
         bool ch4Left, ch4Right;
+
+        int sampleRate; //output rate, the point path resamples from SAMPLE_RATE
+        uint32_t frameClocks; //cycles since the last apu::endFrame
+        int channelOutput[4]; //amplitude each channel last fed to the blip buffers
+        int mixLeft;
+        int mixRight;
+
+        //point sampled block mode: channel amplitudes are collected here and
+        //panned / scaled for the whole block at once
+        static constexpr int MIX_BLOCK = 128;
+        bool blockMixing;
+        int blockPosition;
+
+        //bulky synthesis state last, behind the registers and channels
+        int16_t blockSamples[4][MIX_BLOCK];
+        ResamplerState resampler;
+        BlipState blipLeft;
+        BlipState blipRight;
     };
 
     // Timer state
+    //DIV and TIMA are derived from one free running 16 bit counter
+    //(counter = cycles - divBase) and only brought up to date when read,
+    //written or when the next overflow is due
     struct TimerState {
-        int divCycles;
-        int timaCycles;
+        uint64_t divBase; //scheduler cycle at which the internal counter was 0
+        uint64_t timaSync; //scheduler cycle TIMA was last brought up to date
+        int clockShift; //log2 of the selected TIMA period
+        bool enabled;
+    };
+
+    // Scheduler state
+    //LOCKSTEP runs ppu and apu after every instruction, CATCH_UP only when
+    //their registers are touched, an interrupt is due or the frame ends
+    enum class SyncMode : uint8_t {
+        LOCKSTEP,
+        CATCH_UP
+    };
+
+    struct SchedulerState {
+        static constexpr uint64_t NO_DEADLINE = ~0ull;
+
+        uint64_t cycles; //total cycles since power on
+        uint64_t timerDeadline; //cycle of the next TIMA overflow
+        uint64_t ppuDeadline; //cycle of the next ppu mode transition
+        SyncMode syncMode;
     };
 
     // Joypad state
@@ -141,54 +225,111 @@ namespace gb {
         bool selectDpad;
     };
 
+    // IO register handlers, nullptr means plain storage in io[]
+    struct GBState;
+    typedef uint8_t (*IOReadHandler)(GBState& state, uint8_t reg);
+    typedef void (*IOWriteHandler)(GBState& state, uint8_t reg, uint8_t value);
+
     // Memory state
+    //io / hram / ie first, they are hit far more often than the big arrays
     struct MemoryState {
-        uint8_t vram[0x2000];
-        uint8_t wram[0x2000];
-        uint8_t oam[0xA0];
-        uint8_t io[0x80];
+        alignas(64) uint8_t io[0x80];
         uint8_t hram[0x7F];
         uint8_t ie;
+
+        //FF00-FF7F dispatch, filled by each subsystem's initialize
+        IOReadHandler ioRead[0x80];
+        IOWriteHandler ioWrite[0x80];
+
+        uint8_t oam[0xA0];
+        uint8_t vram[0x2000];
+        uint8_t wram[0x2000];
     };
 
     // Cartridge state
-    enum class MapperType {
+    enum class MapperType : uint8_t {
         NONE,
         MBC1,
         MBC3,
         MBC5
     };
 
+    namespace romcache {
+        struct RomImage;
+    }
+
+    namespace cartridge {
+        struct SharedRAM;
+    }
+
     struct CartridgeState {
         static constexpr int MAX_ROM_SIZE = 8 * 1024 * 1024;
         static constexpr int MAX_RAM_SIZE = 128 * 1024;
+        static constexpr int RAM_PAGE_SIZE = 256; //dirty tracking granularity
+        static constexpr int RAM_DIRTY_WORDS = MAX_RAM_SIZE / RAM_PAGE_SIZE / 64;
 
-        uint8_t* rom;
-        uint8_t* ram;
+        //banking, read on every cartridge access
+        //the bank bases are recomputed only when an MBC register is written;
+        //each window is the number of valid bytes behind its base (0x4000 /
+        //0x2000 unless the image is short), ramBankBase is null while disabled
+        const uint8_t* romBankBase;
+        uint8_t* ramBankBase;
+        uint16_t romBankWindow;
+        uint16_t ramBankWindow;
+        const uint8_t* rom; //immutable image, owned by romImage
+        uint8_t* ram; //data of ramOwner
+        uint64_t* ramDirty; //RAM_DIRTY_WORDS, one bit per sram page written since takeDirtyPages
+        uint16_t romBank;
+        uint8_t ramBank;
+        MapperType mapper;
+        uint8_t mbcMode;
+        bool ramEnabled;
+        bool ramShared; //ram may be referenced by a clone too, copied before the next write
 
+        const romcache::RomImage* romImage; //shared registry entry (see rom_cache.hpp)
+        cartridge::SharedRAM* ramOwner; //reference counted sram allocation
+        bool loaded;
         int romSize;
         int ramSize;
+        char title[17];
+    };
 
-        MapperType mapper;
-        int romBank;
-        int ramBank;
-        bool ramEnabled;
-        int mbcMode;
+    // Large output buffers, written in bursts and read once per frame
+    //inline at the tail of GBState by default; GB_COMPACT_STATE builds leave
+    //them out and allocate each group only once it is used (see buffers.hpp)
+    struct VideoBuffers {
+        alignas(64) uint8_t framebuffer[160 * 144];
+    };
 
-        char title[17];
-        bool loaded;
+    struct AudioBuffers {
+        alignas(64) int16_t samples[APUState::BUFFER_SIZE * 2];
+        alignas(64) int32_t blipLeft[BlipState::DELTA_COUNT];
+        alignas(64) int32_t blipRight[BlipState::DELTA_COUNT];
+    };
+
+    struct BufferState {
+        VideoBuffers video;
+        AudioBuffers audio;
     };
 
     // Complete GB state
-    struct GBState {
+    //ordered hot to cold: registers, scheduler deadlines, timer and bank
+    //pointers share the first two cache lines, the small ppu / joypad state
+    //fills the padding in front of io / hram, then the big arrays and the
+    //apu, and the buffers (when inline) sit at the tail (see layout.hpp)
+    struct alignas(64) GBState {
         CPUState cpu;
-        PPUState ppu;
-        APUState apu;
+        SchedulerState scheduler;
         TimerState timer;
+        CartridgeState cartridge;
+        PPUState ppu;
         JoypadState joypad;
         MemoryState memory;
-        CartridgeState cartridge;
         OpcodeTable opcodes;
+        APUState apu;
+#ifndef GB_COMPACT_STATE
+        BufferState buffers;
+#endif
     };
 
 }
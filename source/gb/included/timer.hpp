@@ -15,7 +15,18 @@ namespace gb {
         constexpr uint8_t REG_TAC = 0x07;
 
         void initialize(GBState& state);
-        void tick(GBState& state, int cycles);
+
+        //bring DIV / TIMA in io up to the scheduler clock
+        void sync(GBState& state);
+
+        //called once the scheduler clock reaches the overflow deadline
+        void update(GBState& state);
+
+        //DIV / TIMA reads sync first
+        uint8_t readRegister(GBState& state, uint8_t reg);
+
+        //DIV / TIMA / TMA / TAC writes, reschedules the overflow
+        void writeRegister(GBState& state, uint8_t reg, uint8_t value);
 
     }
 }
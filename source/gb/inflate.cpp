@@ -0,0 +1,354 @@
+#include "included/inflate.hpp"
+#include <cstring>
+
+namespace gb {
+    namespace inflate {
+
+        static constexpr int MAX_BITS = 15;
+        static constexpr int FAST_BITS = 10;
+        static constexpr int MAX_LITERALS = 288;
+        static constexpr int MAX_DISTANCES = 30;
+
+        //canonical huffman code; codes up to FAST_BITS long resolve with one
+        //table lookup, longer ones walk the per-length counts
+        struct Huffman {
+            uint16_t fast[1 << FAST_BITS]; //(length << 9) | symbol, 0 if longer
+            uint16_t count[MAX_BITS + 1];
+            uint16_t symbol[MAX_LITERALS];
+        };
+
+        struct BitReader {
+            const uint8_t* next;
+            const uint8_t* end;
+            uint64_t bits;
+            int bitCount;
+            int padding; //zero bytes fed past the end of the input
+        };
+
+        static const uint16_t lengthBase[29] = {
+            3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+        };
+        static const uint8_t lengthExtra[29] = {
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+        };
+        static const uint16_t distanceBase[30] = {
+            1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+            257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+            8193, 12289, 16385, 24577
+        };
+        static const uint8_t distanceExtra[30] = {
+            0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+            7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+        };
+        static const uint8_t codeLengthOrder[19] = {
+            16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+        };
+
+        //keeps at least 57 bits buffered; past the input it shifts in zeros
+        //and counts them, so truncation is caught once they are consumed
+        static inline void refill(BitReader& reader) {
+            while (reader.bitCount <= 56) {
+                if (reader.next < reader.end) {
+                    reader.bits |= (uint64_t)*reader.next++ << reader.bitCount;
+                } else {
+                    reader.padding++;
+                }
+                reader.bitCount += 8;
+            }
+        }
+
+        static inline bool overrun(const BitReader& reader) {
+            return reader.bitCount < reader.padding * 8;
+        }
+
+        static inline uint32_t getBits(BitReader& reader, int count) {
+            refill(reader);
+            uint32_t value = (uint32_t)(reader.bits & ((1ull << count) - 1));
+            reader.bits >>= count;
+            reader.bitCount -= count;
+            return value;
+        }
+
+        static bool build(Huffman& code, const uint8_t* lengths, int n) {
+            uint16_t offsets[MAX_BITS + 1];
+
+            memset(code.count, 0, sizeof(code.count));
+            for (int i = 0; i < n; i++) {
+                code.count[lengths[i]]++;
+            }
+            code.count[0] = 0;
+
+            //over subscribed sets are invalid, incomplete ones are allowed
+            int left = 1;
+            for (int len = 1; len <= MAX_BITS; len++) {
+                left = (left << 1) - code.count[len];
+                if (left < 0) return false;
+            }
+
+            offsets[1] = 0;
+            for (int len = 1; len < MAX_BITS; len++) {
+                offsets[len + 1] = offsets[len] + code.count[len];
+            }
+            for (int i = 0; i < n; i++) {
+                if (lengths[i]) {
+                    code.symbol[offsets[lengths[i]]++] = i;
+                }
+            }
+
+            memset(code.fast, 0, sizeof(code.fast));
+            int index = 0;
+            uint32_t next = 0;
+            for (int len = 1; len <= FAST_BITS; len++) {
+                for (int i = 0; i < code.count[len]; i++, index++, next++) {
+                    //codes are packed msb first, the bit reader is lsb first
+                    uint32_t reversed = 0;
+                    for (int b = 0; b < len; b++) {
+                        reversed |= ((next >> b) & 1) << (len - 1 - b);
+                    }
+                    uint16_t entry = (uint16_t)((len << 9) | code.symbol[index]);
+                    for (uint32_t slot = reversed; slot < (1u << FAST_BITS); slot += 1u << len) {
+                        code.fast[slot] = entry;
+                    }
+                }
+                next <<= 1;
+            }
+            return true;
+        }
+
+        //returns the symbol, or -1 for a code not in the table
+        static inline int decodeSymbol(BitReader& reader, const Huffman& code) {
+            refill(reader);
+
+            uint16_t entry = code.fast[reader.bits & ((1 << FAST_BITS) - 1)];
+            if (entry) {
+                int len = entry >> 9;
+                reader.bits >>= len;
+                reader.bitCount -= len;
+                return entry & 0x1FF;
+            }
+
+            int value = 0;
+            int first = 0;
+            int index = 0;
+            for (int len = 1; len <= MAX_BITS; len++) {
+                value |= (int)((reader.bits >> (len - 1)) & 1);
+                int count = code.count[len];
+                if (value - first < count) {
+                    reader.bits >>= len;
+                    reader.bitCount -= len;
+                    return code.symbol[index + (value - first)];
+                }
+                index += count;
+                first = (first + count) << 1;
+                value <<= 1;
+            }
+            return -1;
+        }
+
+        //built on first use; function local statics are initialized once
+        //even with decoders running on several threads
+        struct FixedCodes {
+            Huffman literals;
+            Huffman distances;
+
+            FixedCodes() {
+                uint8_t lengths[MAX_LITERALS];
+                int i = 0;
+                for (; i < 144; i++) lengths[i] = 8;
+                for (; i < 256; i++) lengths[i] = 9;
+                for (; i < 280; i++) lengths[i] = 7;
+                for (; i < MAX_LITERALS; i++) lengths[i] = 8;
+                build(literals, lengths, MAX_LITERALS);
+
+                for (i = 0; i < MAX_DISTANCES; i++) lengths[i] = 5;
+                build(distances, lengths, MAX_DISTANCES);
+            }
+        };
+
+        static const FixedCodes& fixedCodes() {
+            static const FixedCodes codes;
+            return codes;
+        }
+
+        static bool readDynamic(BitReader& reader, Huffman& literals, Huffman& distances) {
+            uint8_t lengths[MAX_LITERALS + MAX_DISTANCES];
+
+            int literalCount = getBits(reader, 5) + 257;
+            int distanceCount = getBits(reader, 5) + 1;
+            int codeLengthCount = getBits(reader, 4) + 4;
+            if (literalCount > MAX_LITERALS - 2 || distanceCount > MAX_DISTANCES) return false;
+
+            memset(lengths, 0, 19);
+            for (int i = 0; i < codeLengthCount; i++) {
+                lengths[codeLengthOrder[i]] = getBits(reader, 3);
+            }
+
+            Huffman codeLengths;
+            if (!build(codeLengths, lengths, 19)) return false;
+
+            int total = literalCount + distanceCount;
+            int i = 0;
+            while (i < total) {
+                int symbol = decodeSymbol(reader, codeLengths);
+                if (symbol < 0) return false;
+
+                if (symbol < 16) {
+                    lengths[i++] = symbol;
+                    continue;
+                }
+
+                uint8_t value = 0;
+                int repeat;
+                if (symbol == 16) {
+                    if (i == 0) return false;
+                    value = lengths[i - 1];
+                    repeat = 3 + getBits(reader, 2);
+                } else if (symbol == 17) {
+                    repeat = 3 + getBits(reader, 3);
+                } else {
+                    repeat = 11 + getBits(reader, 7);
+                }
+                if (i + repeat > total) return false;
+                while (repeat--) lengths[i++] = value;
+            }
+
+            //a block without an end of block code could never finish
+            if (lengths[256] == 0) return false;
+
+            return build(literals, lengths, literalCount) &&
+                   build(distances, lengths + literalCount, distanceCount);
+        }
+
+        static bool decodeBlock(BitReader& reader, const Huffman& literals, const Huffman& distances,
+                                uint8_t* out, size_t outSize, size_t& position) {
+            while (true) {
+                int symbol = decodeSymbol(reader, literals);
+                if (symbol < 0 || overrun(reader)) return false;
+
+                if (symbol < 256) {
+                    if (position >= outSize) return false;
+                    out[position++] = (uint8_t)symbol;
+                    continue;
+                }
+                if (symbol == 256) {
+                    return true;
+                }
+
+                symbol -= 257;
+                if (symbol >= 29) return false;
+                size_t length = lengthBase[symbol] + getBits(reader, lengthExtra[symbol]);
+
+                int distanceSymbol = decodeSymbol(reader, distances);
+                if (distanceSymbol < 0 || distanceSymbol >= MAX_DISTANCES) return false;
+                size_t distance = distanceBase[distanceSymbol] + getBits(reader, distanceExtra[distanceSymbol]);
+
+                if (distance > position || length > outSize - position) return false;
+
+                //byte by byte, overlapping copies repeat the recent output
+                const uint8_t* from = out + position - distance;
+                uint8_t* to = out + position;
+                for (size_t i = 0; i < length; i++) {
+                    to[i] = from[i];
+                }
+                position += length;
+            }
+        }
+
+        static bool copyStored(BitReader& reader, uint8_t* out, size_t outSize, size_t& position) {
+            //drop to a byte boundary and hand the buffered bytes back
+            reader.bits >>= reader.bitCount & 7;
+            reader.bitCount &= ~7;
+            int buffered = reader.bitCount / 8 - reader.padding;
+            if (buffered < 0) return false;
+            reader.next -= buffered;
+            reader.bits = 0;
+            reader.bitCount = 0;
+            reader.padding = 0;
+
+            if (reader.end - reader.next < 4) return false;
+            size_t length = reader.next[0] | (reader.next[1] << 8);
+            size_t check = reader.next[2] | (reader.next[3] << 8);
+            reader.next += 4;
+            if (length != (~check & 0xFFFF)) return false;
+
+            if ((size_t)(reader.end - reader.next) < length || length > outSize - position) return false;
+            memcpy(out + position, reader.next, length);
+            reader.next += length;
+            position += length;
+            return true;
+        }
+
+        bool decode(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize,
+                    size_t* consumed, size_t* written) {
+            const FixedCodes& fixed = fixedCodes();
+
+            BitReader reader;
+            reader.next = in;
+            reader.end = in + inSize;
+            reader.bits = 0;
+            reader.bitCount = 0;
+            reader.padding = 0;
+
+            Huffman literals;
+            Huffman distances;
+            size_t position = 0;
+            bool last = false;
+            bool ok = true;
+
+            while (ok && !last) {
+                last = getBits(reader, 1) != 0;
+                int type = getBits(reader, 2);
+
+                switch (type) {
+                    case 0:
+                        ok = copyStored(reader, out, outSize, position);
+                        break;
+                    case 1:
+                        ok = decodeBlock(reader, fixed.literals, fixed.distances, out, outSize, position);
+                        break;
+                    case 2:
+                        ok = readDynamic(reader, literals, distances) &&
+                             decodeBlock(reader, literals, distances, out, outSize, position);
+                        break;
+                    default:
+                        ok = false;
+                        break;
+                }
+                if (overrun(reader)) ok = false;
+            }
+
+            if (consumed) *consumed = (reader.next - in) - (reader.bitCount / 8 - reader.padding);
+            if (written) *written = position;
+            return ok;
+        }
+
+        //same once only initialization as the fixed codes, crc32 runs on
+        //save journal threads and the rom loader at the same time
+        struct CrcTable {
+            uint32_t entries[256];
+
+            CrcTable() {
+                for (uint32_t i = 0; i < 256; i++) {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; k++) {
+                        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    }
+                    entries[i] = c;
+                }
+            }
+        };
+
+        uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc) {
+            static const CrcTable table;
+
+            crc = ~crc;
+            for (size_t i = 0; i < size; i++) {
+                crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+            }
+            return ~crc;
+        }
+
+    }
+}
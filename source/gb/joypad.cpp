@@ -1,9 +1,18 @@
 #include "included/joypad.hpp"
 #include "included/state.hpp"
+#include "included/memory.hpp"
 
 namespace gb {
     namespace joypad {
 
+        static uint8_t readJOYP(GBState& state, uint8_t reg) {
+            return read(state);
+        }
+
+        static void writeJOYP(GBState& state, uint8_t reg, uint8_t value) {
+            write(state, value);
+        }
+
         void initialize(GBState& state) {
             auto& jp = state.joypad;
 
@@ -17,6 +26,8 @@ namespace gb {
             jp.dpadRight = false;
             jp.selectButtons = false;
             jp.selectDpad = false;
+
+            memory::registerIO(state, memory::IO_JOYP, readJOYP, writeJOYP);
         }
 
         uint8_t read(GBState& state) {
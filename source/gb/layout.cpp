@@ -0,0 +1,79 @@
+#include "included/layout.hpp"
+#include "included/state.hpp"
+#include <cstdio>
+
+namespace gb {
+    namespace layout {
+
+        //field offset inside GBState
+        #define GB_OFFSET(member, field) (offsetof(GBState, member) + offsetof(decltype(GBState::member), field))
+
+        static_assert(alignof(GBState) >= CACHE_LINE, "GBState must start on a cache line");
+        static_assert(offsetof(GBState, cpu) == 0, "cpu registers lead the state");
+        static_assert(GB_OFFSET(cartridge, ramEnabled) < HOT_HEAD_BYTES,
+                      "cpu, scheduler, timer and bank pointers must share the first two cache lines");
+        static_assert(GB_OFFSET(memory, io) % CACHE_LINE == 0, "io registers start on a cache line");
+        static_assert(GB_OFFSET(memory, ie) < HOT_BYTES, "io / hram / ie must stay in the hot region");
+        static_assert(offsetof(AudioBuffers, blipLeft) % CACHE_LINE == 0 &&
+                      offsetof(AudioBuffers, blipRight) % CACHE_LINE == 0, "buffers are cache line aligned");
+#ifdef GB_COMPACT_STATE
+        static_assert(sizeof(GBState) <= COMPACT_STATE_BUDGET, "compact state over its per instance budget");
+#else
+        static_assert(offsetof(GBState, buffers) + sizeof(BufferState) == sizeof(GBState),
+                      "buffers sit at the tail of the state");
+#endif
+
+        #undef GB_OFFSET
+
+        #define GB_ENTRY(member) { #member, offsetof(GBState, member), sizeof(GBState::member) }
+
+        static const Entry table[] = {
+            GB_ENTRY(cpu),
+            GB_ENTRY(scheduler),
+            GB_ENTRY(timer),
+            GB_ENTRY(cartridge),
+            GB_ENTRY(ppu),
+            GB_ENTRY(joypad),
+            GB_ENTRY(memory),
+            GB_ENTRY(opcodes),
+            GB_ENTRY(apu),
+#ifndef GB_COMPACT_STATE
+            GB_ENTRY(buffers),
+#endif
+        };
+
+        #undef GB_ENTRY
+
+        int entries(const Entry*& out) {
+            out = table;
+            return sizeof(table) / sizeof(table[0]);
+        }
+
+        int report(char* buffer, size_t size) {
+            int length = 0;
+
+            //keep counting past a full buffer like snprintf does
+            auto append = [&](int written) {
+                if (written > 0) length += written;
+            };
+            auto remaining = [&]() -> size_t {
+                return (size_t)length < size ? size - length : 0;
+            };
+            auto cursor = [&]() -> char* {
+                return (size_t)length < size ? buffer + length : nullptr;
+            };
+
+            append(snprintf(cursor(), remaining(), "GBState %u bytes, align %u\n",
+                            (unsigned)sizeof(GBState), (unsigned)alignof(GBState)));
+
+            for (const Entry& e : table) {
+                append(snprintf(cursor(), remaining(), "%-10s @%6u %6u bytes  lines %u-%u\n", e.name,
+                                (unsigned)e.offset, (unsigned)e.size, (unsigned)(e.offset / CACHE_LINE),
+                                (unsigned)((e.offset + e.size - 1) / CACHE_LINE)));
+            }
+
+            return length;
+        }
+
+    }
+}
@@ -28,9 +28,21 @@ namespace gb {
         void initialize(GBState& state) {
             auto& ppu = state.ppu;
 
-            memset(ppu.framebuffer, 0, sizeof(ppu.framebuffer));
+            //the framebuffer itself is bound by buffers::initialize / attachVideo
+            if (ppu.framebuffer) {
+                memset(ppu.framebuffer, 0, SCREEN_WIDTH * SCREEN_HEIGHT);
+            }
             ppu.frameReady = false;
             ppu.scanlineCycles = 0;
+            ppu.lastSync = state.scheduler.cycles;
+            ppu.eventDriven = true;
+            ppu.skippedTicks = 0;
+            scheduleNextEvent(state);
+
+            memory::registerIO(state, memory::IO_LY, readRegister, nullptr);
+            memory::registerIO(state, memory::IO_STAT, readRegister, writeRegister);
+            memory::registerIO(state, memory::IO_LCDC, nullptr, writeRegister);
+            memory::registerIO(state, memory::IO_LYC, nullptr, writeRegister);
 
             //build the lookup table from here
             static bool lutBuilt = false;
@@ -42,62 +54,84 @@ namespace gb {
 
         void tick(GBState& state, int cycles) {
             auto& ppu = state.ppu;
-            auto& io = state.memory.io;
-
-            uint8_t lcdc = io[memory::IO_LCDC];
 
-            if (!(lcdc & 0x80)) {
+            //lcd off: the ppu is frozen, nothing to do
+            if (!(state.memory.io[memory::IO_LCDC] & 0x80)) {
+                ppu.skippedTicks++;
                 return;
             }
 
             ppu.scanlineCycles += cycles;
 
+            //fast path: no mode transition due yet
+            if (ppu.scanlineCycles < ppu.nextEventCycles) {
+                ppu.skippedTicks++;
+                return;
+            }
+
+            //a single tick can cover more than one transition in event mode
+            while (ppu.scanlineCycles >= ppu.nextEventCycles) {
+                advanceMode(state);
+                scheduleNextEvent(state);
+            }
+        }
+
+        void catchUp(GBState& state) {
+            auto& ppu = state.ppu;
+
+            int cycles = (int)(state.scheduler.cycles - ppu.lastSync);
+            if (cycles == 0) return;
+
+            ppu.lastSync = state.scheduler.cycles;
+            tick(state, cycles);
+        }
+
+        void advanceMode(GBState& state) {
+            auto& ppu = state.ppu;
+            auto& io = state.memory.io;
+
             uint8_t stat = io[memory::IO_STAT];
             uint8_t mode = stat & 0x03;
             uint8_t ly = io[memory::IO_LY];
 
             switch (mode) {
                 case MODE_OAM:
-                    if (ppu.scanlineCycles >= CYCLES_OAM) {
-                        io[memory::IO_STAT] = (stat & 0xFC) | MODE_DRAWING;
-                    }
+                    io[memory::IO_STAT] = (stat & 0xFC) | MODE_DRAWING;
                     break;
 
                 case MODE_DRAWING:
-                    if (ppu.scanlineCycles >= CYCLES_OAM + CYCLES_DRAWING) {
-                        renderScanline(state);
-                        io[memory::IO_STAT] = (stat & 0xFC) | MODE_HBLANK;
-                        if (stat & 0x08) {
-                            io[memory::IO_IF] |= 0x02;
-                        }
+                    renderScanline(state);
+                    io[memory::IO_STAT] = (stat & 0xFC) | MODE_HBLANK;
+                    if (stat & 0x08) {
+                        memory::requestInterrupt(state, 0x02);
                     }
                     break;
 
                 case MODE_HBLANK:
-                    if (ppu.scanlineCycles >= CYCLES_SCANLINE) {
-                        ppu.scanlineCycles -= CYCLES_SCANLINE;
-                        io[memory::IO_LY]++;
-                        ly = io[memory::IO_LY];
-
-                        if (ly >= SCANLINES_VISIBLE) {
-                            io[memory::IO_STAT] = (stat & 0xFC) | MODE_VBLANK;
-                            io[memory::IO_IF] |= 0x01;
-                            if (stat & 0x10) {
-                                io[memory::IO_IF] |= 0x02;
-                            }
-                            ppu.frameReady = true;
-                        } else {
-                            io[memory::IO_STAT] = (stat & 0xFC) | MODE_OAM;
-                            if (stat & 0x20) {
-                                io[memory::IO_IF] |= 0x02;
-                            }
+                    ppu.scanlineCycles -= CYCLES_SCANLINE;
+                    io[memory::IO_LY]++;
+                    ly = io[memory::IO_LY];
+
+                    if (ly >= SCANLINES_VISIBLE) {
+                        io[memory::IO_STAT] = (stat & 0xFC) | MODE_VBLANK;
+                        memory::requestInterrupt(state, 0x01);
+                        if (stat & 0x10) {
+                            memory::requestInterrupt(state, 0x02);
+                        }
+                        ppu.frameReady = true;
+                    } else {
+                        io[memory::IO_STAT] = (stat & 0xFC) | MODE_OAM;
+                        if (stat & 0x20) {
+                            memory::requestInterrupt(state, 0x02);
                         }
-                        checkLYC(state);
                     }
+                    checkLYC(state);
                     break;
 
                 case MODE_VBLANK:
-                    if (ppu.scanlineCycles >= CYCLES_SCANLINE) {
+                    //in event mode several vblank lines are retired here at once
+                    do {
+                        stat = io[memory::IO_STAT];
                         ppu.scanlineCycles -= CYCLES_SCANLINE;
                         io[memory::IO_LY]++;
                         ly = io[memory::IO_LY];
@@ -106,15 +140,109 @@ namespace gb {
                             io[memory::IO_LY] = 0;
                             io[memory::IO_STAT] = (stat & 0xFC) | MODE_OAM;
                             if (stat & 0x20) {
-                                io[memory::IO_IF] |= 0x02;
+                                memory::requestInterrupt(state, 0x02);
                             }
+                            checkLYC(state);
+                            break;
                         }
                         checkLYC(state);
+                    } while (ppu.scanlineCycles >= CYCLES_SCANLINE);
+                    break;
+            }
+        }
+
+        void scheduleNextEvent(GBState& state) {
+            auto& ppu = state.ppu;
+            auto& io = state.memory.io;
+
+            uint8_t stat = io[memory::IO_STAT];
+
+            switch (stat & 0x03) {
+                case MODE_OAM:
+                    ppu.nextEventCycles = CYCLES_OAM;
+                    break;
+
+                case MODE_DRAWING:
+                    ppu.nextEventCycles = CYCLES_OAM + CYCLES_DRAWING;
+                    break;
+
+                case MODE_HBLANK:
+                    ppu.nextEventCycles = CYCLES_SCANLINE;
+                    break;
+
+                case MODE_VBLANK: {
+                    if (!ppu.eventDriven) {
+                        ppu.nextEventCycles = CYCLES_SCANLINE;
+                        break;
+                    }
+
+                    //nothing observable happens until the end of vblank, unless
+                    //a LYC interrupt is armed for one of the remaining lines
+                    int ly = io[memory::IO_LY];
+                    int lyc = io[memory::IO_LYC];
+                    int lines = SCANLINES_TOTAL - ly;
+                    if ((stat & 0x40) && lyc > ly && lyc < SCANLINES_TOTAL) {
+                        lines = lyc - ly;
+                    }
+                    if (lines < 1) {
+                        lines = 1;
                     }
+                    ppu.nextEventCycles = lines * CYCLES_SCANLINE;
                     break;
+                }
+            }
+
+            //a frozen lcd never raises anything
+            if (io[memory::IO_LCDC] & 0x80) {
+                state.scheduler.ppuDeadline = ppu.lastSync + (ppu.nextEventCycles - ppu.scanlineCycles);
+            } else {
+                state.scheduler.ppuDeadline = SchedulerState::NO_DEADLINE;
             }
         }
 
+        void sync(GBState& state) {
+            auto& ppu = state.ppu;
+            auto& io = state.memory.io;
+
+            catchUp(state);
+
+            if (!ppu.eventDriven || !(io[memory::IO_LCDC] & 0x80)) {
+                return;
+            }
+
+            //bring LY and the coincidence flag up to date for batched vblank lines
+            if ((io[memory::IO_STAT] & 0x03) == MODE_VBLANK && ppu.scanlineCycles >= CYCLES_SCANLINE) {
+                advanceMode(state);
+                scheduleNextEvent(state);
+            }
+        }
+
+        uint8_t readRegister(GBState& state, uint8_t reg) {
+            sync(state);
+            return state.memory.io[reg];
+        }
+
+        void writeRegister(GBState& state, uint8_t reg, uint8_t value) {
+            auto& io = state.memory.io;
+
+            sync(state);
+
+            if (reg == memory::IO_STAT) {
+                //mode and coincidence bits are read only
+                io[reg] = (value & 0x78) | (io[reg] & 0x07);
+            } else {
+                io[reg] = value;
+            }
+
+            scheduleNextEvent(state);
+        }
+
+        void setEventDriven(GBState& state, bool enabled) {
+            sync(state);
+            state.ppu.eventDriven = enabled;
+            scheduleNextEvent(state);
+        }
+
         void checkLYC(GBState& state) {
             auto& io = state.memory.io;
             uint8_t stat = io[memory::IO_STAT];
@@ -122,7 +250,7 @@ namespace gb {
             if (io[memory::IO_LY] == io[memory::IO_LYC]) {
                 io[memory::IO_STAT] |= 0x04;
                 if (stat & 0x40) {
-                    io[memory::IO_IF] |= 0x02;
+                    memory::requestInterrupt(state, 0x02);
                 }
             } else {
                 io[memory::IO_STAT] &= ~0x04;
@@ -133,6 +261,9 @@ namespace gb {
             auto& io = state.memory.io;
             uint8_t lcdc = io[memory::IO_LCDC];
 
+            //headless, nothing to draw into
+            if (!state.ppu.framebuffer) return;
+
             if (lcdc & 0x01) renderBackground(state);
             if (lcdc & 0x20) renderWindow(state);
             if (lcdc & 0x02) renderSprites(state);
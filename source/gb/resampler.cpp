@@ -0,0 +1,68 @@
+#include "included/resampler.hpp"
+#include "included/blip_buffer.hpp"
+#include <cstring>
+
+namespace gb {
+    namespace resampler {
+
+        static constexpr int FRAC_BITS = 16;
+        static constexpr int TAPS = ResamplerState::TAPS;
+
+        void configure(ResamplerState& rs, int inputRate, int outputRate) {
+            rs.inputRate = inputRate;
+            rs.outputRate = outputRate;
+
+            //input frames advanced per output frame, 16.16
+            rs.step = (uint32_t)(((uint64_t)inputRate << FRAC_BITS) / outputRate);
+
+            //downsampling has to cut below the new nyquist
+            double cutoff = 0.9;
+            if (outputRate < inputRate) {
+                cutoff = 0.9 * outputRate / inputRate;
+            }
+            blip::designKernel(rs.kernel, cutoff);
+
+            reset(rs);
+        }
+
+        void reset(ResamplerState& rs) {
+            memset(rs.history, 0, sizeof(rs.history));
+            rs.position = 0;
+        }
+
+        int process(ResamplerState& rs, const int16_t* in, int count, int16_t* out, int space) {
+            int written = 0;
+
+            for (int n = 0; n < count; n++) {
+                //slide the stereo history window by one frame
+                memmove(rs.history, rs.history + 2, (TAPS - 1) * 2 * sizeof(int16_t));
+                rs.history[(TAPS - 1) * 2] = in[n * 2];
+                rs.history[(TAPS - 1) * 2 + 1] = in[n * 2 + 1];
+
+                //every output that falls inside this input frame
+                while (rs.position < (1u << FRAC_BITS)) {
+                    const int16_t* k = rs.kernel[rs.position >> (FRAC_BITS - blip::PHASE_BITS)];
+                    int32_t left = 0;
+                    int32_t right = 0;
+                    for (int i = 0; i < TAPS; i++) {
+                        left += k[i] * rs.history[i * 2];
+                        right += k[i] * rs.history[i * 2 + 1];
+                    }
+                    left >>= blip::KERNEL_BITS;
+                    right >>= blip::KERNEL_BITS;
+
+                    if (written < space) {
+                        out[written * 2] = (int16_t)(left > 32767 ? 32767 : (left < -32768 ? -32768 : left));
+                        out[written * 2 + 1] = (int16_t)(right > 32767 ? 32767 : (right < -32768 ? -32768 : right));
+                        written++;
+                    }
+                    rs.position += rs.step;
+                }
+                rs.position -= 1u << FRAC_BITS;
+            }
+
+            return written;
+        }
+
+    }
+}
@@ -0,0 +1,574 @@
+#include "included/rom_cache.hpp"
+#include "included/state.hpp"
+#include "included/archive.hpp"
+#include <cstring>
+#include <cstdio>
+#include <mutex>
+#include <atomic>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define GB_ROM_MMAP 1
+#endif
+
+namespace gb {
+    namespace romcache {
+
+        //a file that has already been resolved to an image
+        struct FileAlias {
+#ifdef GB_ROM_MMAP
+            dev_t device;
+            ino_t inode;
+            off_t size;
+            time_t mtime;
+            long mtimeNanos;
+#endif
+            RomImage* image;
+            FileAlias* next;
+        };
+
+        //an archive already decompressed, found again by its own hash so a
+        //copy under another name skips the inflate
+        struct ArchiveAlias {
+            uint64_t hash;
+            int size;
+            RomImage* image;
+            ArchiveAlias* next;
+        };
+
+        //an image (or archive) loaded but not registered yet
+        struct Loaded {
+            const uint8_t* data;
+            int size;
+            Backing backing;
+        };
+
+#ifdef GB_ROM_MMAP
+        //an inflated archive published for other processes: a header, then
+        //the image. The object is named after the archive file's identity, so
+        //another process finds it with the stat it needs anyway, before it
+        //reads, hashes or inflates anything
+        struct SharedHeader {
+            char magic[4];
+            std::atomic<uint32_t> ready; //stored last by the creator
+            uint64_t hash; //of the image
+            int32_t size;
+            uint64_t identity[5]; //device, inode, size, mtime, mtime nanos of the archive
+        };
+
+        static constexpr size_t SHARED_HEADER_BYTES = 64;
+        static_assert(sizeof(SharedHeader) <= SHARED_HEADER_BYTES, "shm header outgrew its slot");
+        static const char SHARED_MAGIC[4] = { 'G', 'B', 'R', 'M' };
+#endif
+
+        static std::mutex registryMutex;
+        static RomImage* images = nullptr;
+        static FileAlias* aliases = nullptr;
+        static ArchiveAlias* archives = nullptr;
+        static bool sharedMemory = false;
+
+        static void freeLoaded(Loaded& loaded) {
+            if (!loaded.data) return;
+
+#ifdef GB_ROM_MMAP
+            if (loaded.backing == Backing::FILE_MAP) {
+                munmap(const_cast<uint8_t*>(loaded.data), loaded.size);
+                loaded.data = nullptr;
+                return;
+            }
+            if (loaded.backing == Backing::SHARED_MEMORY) {
+                //the image follows the object's header
+                munmap(const_cast<uint8_t*>(loaded.data) - SHARED_HEADER_BYTES, SHARED_HEADER_BYTES + loaded.size);
+                loaded.data = nullptr;
+                return;
+            }
+#endif
+            delete[] loaded.data;
+            loaded.data = nullptr;
+        }
+
+#ifdef GB_ROM_MMAP
+        //map the file read only, pages are shared with every other mapping of
+        //the same file and only faulted in when touched
+        static bool mapFile(int fd, const struct stat& info, Loaded& out) {
+            if (info.st_size <= 0 || info.st_size > CartridgeState::MAX_ROM_SIZE) {
+                return false;
+            }
+
+            void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                return false;
+            }
+
+            out.data = static_cast<const uint8_t*>(mapping);
+            out.size = (int)info.st_size;
+            out.backing = Backing::FILE_MAP;
+            return true;
+        }
+
+        //heap copy through the same descriptor, for files that can not be mapped
+        static bool readDescriptor(int fd, const struct stat& info, Loaded& out) {
+            if (info.st_size <= 0 || info.st_size > CartridgeState::MAX_ROM_SIZE) {
+                return false;
+            }
+
+            uint8_t* image = new uint8_t[info.st_size];
+            size_t done = 0;
+            while (done < (size_t)info.st_size) {
+                ssize_t n = pread(fd, image + done, info.st_size - done, done);
+                if (n <= 0) {
+                    delete[] image;
+                    return false;
+                }
+                done += n;
+            }
+
+            out.data = image;
+            out.size = (int)info.st_size;
+            out.backing = Backing::HEAP;
+            return true;
+        }
+
+        static void fileIdentity(const struct stat& info, uint64_t (&identity)[5]) {
+            identity[0] = info.st_dev;
+            identity[1] = info.st_ino;
+            identity[2] = info.st_size;
+            identity[3] = info.st_mtim.tv_sec;
+            identity[4] = info.st_mtim.tv_nsec;
+        }
+
+        static void sharedName(uint64_t key, char* name, size_t length) {
+            snprintf(name, length, "/gbemu-rom-%016llx", (unsigned long long)key);
+        }
+
+        //map the image another process published for this archive file; one
+        //still being written (or left half written) is not waited for, the
+        //caller loads the file itself
+        static bool findShared(uint64_t key, const uint64_t (&identity)[5], Loaded& out, uint64_t& imageHash) {
+            char name[64];
+            sharedName(key, name, sizeof(name));
+
+            int fd = shm_open(name, O_RDONLY, 0);
+            if (fd < 0) {
+                return false;
+            }
+
+            struct stat info;
+            bool usable = fstat(fd, &info) == 0 && info.st_uid == geteuid() &&
+                          info.st_size > (off_t)SHARED_HEADER_BYTES &&
+                          info.st_size - (off_t)SHARED_HEADER_BYTES <= CartridgeState::MAX_ROM_SIZE;
+            void* mapping = usable ? mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+            close(fd);
+            if (mapping == MAP_FAILED) {
+                return false;
+            }
+
+            const SharedHeader* header = static_cast<const SharedHeader*>(mapping);
+            int size = (int)(info.st_size - SHARED_HEADER_BYTES);
+            if (header->ready.load(std::memory_order_acquire) != 1 ||
+                memcmp(header->magic, SHARED_MAGIC, sizeof(SHARED_MAGIC)) != 0 || header->size != size ||
+                memcmp(header->identity, identity, sizeof(identity)) != 0) {
+                munmap(mapping, info.st_size);
+                return false;
+            }
+
+            out.data = static_cast<const uint8_t*>(mapping) + SHARED_HEADER_BYTES;
+            out.size = size;
+            out.backing = Backing::SHARED_MEMORY;
+            imageHash = header->hash;
+            return true;
+        }
+
+        //copy an inflated image into a new shm object; fails if the name is
+        //taken, by another process racing on the same archive or by a stale
+        //object of one that died while writing
+        static bool publishShared(uint64_t key, const uint64_t (&identity)[5], uint64_t imageHash,
+                                  const Loaded& source, Loaded& out) {
+            char name[64];
+            sharedName(key, name, sizeof(name));
+
+            int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+            if (fd < 0) {
+                return false;
+            }
+
+            size_t total = SHARED_HEADER_BYTES + source.size;
+            void* mapping = ftruncate(fd, total) == 0 ? mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                                                      : MAP_FAILED;
+            close(fd);
+            if (mapping == MAP_FAILED) {
+                shm_unlink(name);
+                return false;
+            }
+
+            //ftruncate zero filled the header, ready reads 0 until the end
+            SharedHeader* header = static_cast<SharedHeader*>(mapping);
+            uint8_t* data = static_cast<uint8_t*>(mapping) + SHARED_HEADER_BYTES;
+            memcpy(data, source.data, source.size);
+            memcpy(header->magic, SHARED_MAGIC, sizeof(SHARED_MAGIC));
+            header->hash = imageHash;
+            header->size = source.size;
+            memcpy(header->identity, identity, sizeof(identity));
+            header->ready.store(1, std::memory_order_release);
+            mprotect(mapping, total, PROT_READ);
+
+            out.data = data;
+            out.size = source.size;
+            out.backing = Backing::SHARED_MEMORY;
+            return true;
+        }
+#endif
+
+        //buffered read into a private heap copy, everywhere mmap is not available
+        static bool readFile(const char* filePath, Loaded& out) {
+            FILE* file = fopen(filePath, "rb");
+            if (!file) {
+                return false;
+            }
+
+            fseek(file, 0, SEEK_END);
+            long size = ftell(file);
+            fseek(file, 0, SEEK_SET);
+
+            if (size <= 0 || size > CartridgeState::MAX_ROM_SIZE) {
+                fclose(file);
+                return false;
+            }
+
+            uint8_t* image = new uint8_t[size];
+            if (fread(image, 1, size, file) != (size_t)size) {
+                delete[] image;
+                fclose(file);
+                return false;
+            }
+            fclose(file);
+
+            out.data = image;
+            out.size = (int)size;
+            out.backing = Backing::HEAP;
+            return true;
+        }
+
+        uint64_t hash(const uint8_t* data, size_t size) {
+            //64 bit fnv-1a over whole words, then the tail bytes
+            const uint64_t prime = 1099511628211ULL;
+            uint64_t h = 14695981039346656037ULL ^ size;
+
+            size_t i = 0;
+            for (; i + 8 <= size; i += 8) {
+                uint64_t word;
+                memcpy(&word, data + i, 8);
+                h = (h ^ word) * prime;
+                h ^= h >> 29;
+            }
+            for (; i < size; i++) {
+                h = (h ^ data[i]) * prime;
+            }
+            return h;
+        }
+
+#ifdef GB_ROM_MMAP
+        static RomImage* findAlias(const struct stat& info) {
+            for (FileAlias* alias = aliases; alias; alias = alias->next) {
+                if (alias->device == info.st_dev && alias->inode == info.st_ino && alias->size == info.st_size &&
+                    alias->mtime == info.st_mtim.tv_sec && alias->mtimeNanos == info.st_mtim.tv_nsec) {
+                    return alias->image;
+                }
+            }
+            return nullptr;
+        }
+
+        static void addAlias(const struct stat& info, RomImage* image) {
+            FileAlias* alias = new FileAlias;
+            alias->device = info.st_dev;
+            alias->inode = info.st_ino;
+            alias->size = info.st_size;
+            alias->mtime = info.st_mtim.tv_sec;
+            alias->mtimeNanos = info.st_mtim.tv_nsec;
+            alias->image = image;
+            alias->next = aliases;
+            aliases = alias;
+        }
+#endif
+
+        static RomImage* findArchive(uint64_t archiveHash, int archiveSize) {
+            for (ArchiveAlias* it = archives; it; it = it->next) {
+                if (it->hash == archiveHash && it->size == archiveSize) {
+                    return it->image;
+                }
+            }
+            return nullptr;
+        }
+
+        //same content under another path shares the existing image; file
+        //mappings take no part, their pages follow the file (an edit shows
+        //through, a truncation faults), so they are only ever shared by
+        //the identity of the file they map
+        static RomImage* findImage(uint64_t h, const Loaded& loaded) {
+            if (loaded.backing == Backing::FILE_MAP) {
+                return nullptr;
+            }
+            for (RomImage* it = images; it; it = it->next) {
+                if (it->backing != Backing::FILE_MAP && it->hash == h && it->size == loaded.size &&
+                    memcmp(it->data, loaded.data, loaded.size) == 0) {
+                    return it;
+                }
+            }
+            return nullptr;
+        }
+
+        //the registry lock is only held to look up and to register; reading,
+        //hashing and inflating run unlocked in between, so two threads may
+        //load the same rom at once and the later one drops its copy for the
+        //image the first registered
+        const RomImage* acquire(const char* filePath) {
+            uint64_t key = 0; //shm name, when shared
+#ifdef GB_ROM_MMAP
+            //the alias key and the contents both come from this one open
+            //file, a file replaced under the path in between can not pair
+            //one file's key with the other's contents
+            struct stat info;
+            int fd = open(filePath, O_RDONLY);
+            bool haveInfo = fd >= 0 && fstat(fd, &info) == 0;
+            bool share;
+
+            //fast path: this very file was resolved before
+            {
+                std::lock_guard<std::mutex> lock(registryMutex);
+                share = sharedMemory && haveInfo;
+                RomImage* known = haveInfo ? findAlias(info) : nullptr;
+                if (known) {
+                    known->refs++;
+                    close(fd);
+                    return known;
+                }
+            }
+
+            uint64_t identity[5] = {};
+            if (share) {
+                fileIdentity(info, identity);
+                key = hash(reinterpret_cast<const uint8_t*>(identity), sizeof(identity));
+            }
+#endif
+
+            Loaded loaded = { nullptr, 0, Backing::HEAP };
+            uint64_t h = 0;
+            bool ok = false;
+#ifdef GB_ROM_MMAP
+            //an archive another process inflated already
+            ok = share && findShared(key, identity, loaded, h);
+            if (!ok && haveInfo) {
+                ok = mapFile(fd, info, loaded) || readDescriptor(fd, info, loaded);
+            } else if (!ok) {
+                ok = readFile(filePath, loaded);
+            }
+            if (fd >= 0) {
+                close(fd); //a mapping keeps the file alive
+            }
+#else
+            ok = readFile(filePath, loaded);
+#endif
+            if (!ok) {
+                return nullptr;
+            }
+
+            bool compressed = false;
+            bool published = false; //loaded is a shm object this process created
+            uint64_t archiveHash = 0;
+            int archiveSize = 0;
+            if (loaded.backing != Backing::SHARED_MEMORY) {
+                //archives are decompressed into a private heap image first,
+                //unless the same archive was seen before
+                compressed = archive::detect(loaded.data, loaded.size) != archive::Format::RAW;
+                if (compressed) {
+                    archiveHash = hash(loaded.data, loaded.size);
+                    archiveSize = loaded.size;
+
+                    RomImage* known;
+                    {
+                        std::lock_guard<std::mutex> lock(registryMutex);
+                        known = findArchive(archiveHash, archiveSize);
+                        if (known) {
+                            known->refs++;
+#ifdef GB_ROM_MMAP
+                            if (haveInfo) {
+                                addAlias(info, known);
+                            }
+#endif
+                        }
+                    }
+                    if (known) {
+                        freeLoaded(loaded);
+                        return known;
+                    }
+
+                    uint8_t* unpacked;
+                    int unpackedSize;
+                    ok = archive::extract(loaded.data, loaded.size, CartridgeState::MAX_ROM_SIZE, unpacked, unpackedSize);
+                    freeLoaded(loaded);
+                    if (!ok) {
+                        return nullptr;
+                    }
+                    loaded.data = unpacked;
+                    loaded.size = unpackedSize;
+                    loaded.backing = Backing::HEAP;
+                }
+
+                if (loaded.size < MIN_ROM_SIZE) {
+                    freeLoaded(loaded);
+                    return nullptr;
+                }
+                h = hash(loaded.data, loaded.size);
+
+#ifdef GB_ROM_MMAP
+                //only what took an inflate to get is published, other
+                //processes mapping a raw rom share its page cache already
+                Loaded shared;
+                if (share && compressed && publishShared(key, identity, h, loaded, shared)) {
+                    freeLoaded(loaded);
+                    loaded = shared;
+                    published = true;
+                }
+#endif
+            }
+
+            std::lock_guard<std::mutex> lock(registryMutex);
+
+            RomImage* image = findImage(h, loaded);
+            if (image) {
+#ifdef GB_ROM_MMAP
+                if (published) {
+                    char name[64];
+                    sharedName(key, name, sizeof(name));
+                    shm_unlink(name);
+                }
+#endif
+                freeLoaded(loaded);
+            } else {
+                image = new RomImage;
+                image->data = loaded.data;
+                image->size = loaded.size;
+                image->hash = h;
+                image->backing = loaded.backing;
+                image->refs = 0;
+                image->ownsSharedName = published;
+                image->sharedKey = published ? key : 0;
+                image->next = images;
+                images = image;
+            }
+
+            if (compressed && !findArchive(archiveHash, archiveSize)) {
+                ArchiveAlias* alias = new ArchiveAlias;
+                alias->hash = archiveHash;
+                alias->size = archiveSize;
+                alias->image = image;
+                alias->next = archives;
+                archives = alias;
+            }
+
+#ifdef GB_ROM_MMAP
+            if (haveInfo) {
+                addAlias(info, image);
+            }
+#endif
+
+            image->refs++;
+            return image;
+        }
+
+        void retain(const RomImage* image) {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            const_cast<RomImage*>(image)->refs++;
+        }
+
+        void release(const RomImage* released) {
+            if (!released) return;
+
+            std::lock_guard<std::mutex> lock(registryMutex);
+
+            RomImage** link = &images;
+            while (*link && *link != released) {
+                link = &(*link)->next;
+            }
+            RomImage* image = *link;
+            if (!image || --image->refs > 0) {
+                return;
+            }
+
+            *link = image->next;
+
+            FileAlias** aliasLink = &aliases;
+            while (*aliasLink) {
+                FileAlias* alias = *aliasLink;
+                if (alias->image == image) {
+                    *aliasLink = alias->next;
+                    delete alias;
+                } else {
+                    aliasLink = &alias->next;
+                }
+            }
+
+            ArchiveAlias** archiveLink = &archives;
+            while (*archiveLink) {
+                ArchiveAlias* alias = *archiveLink;
+                if (alias->image == image) {
+                    *archiveLink = alias->next;
+                    delete alias;
+                } else {
+                    archiveLink = &alias->next;
+                }
+            }
+
+            Loaded loaded = { image->data, image->size, image->backing };
+            freeLoaded(loaded);
+
+#ifdef GB_ROM_MMAP
+            //processes still mapping it keep their pages, new ones recreate it
+            if (image->ownsSharedName) {
+                char name[64];
+                sharedName(image->sharedKey, name, sizeof(name));
+                shm_unlink(name);
+            }
+#endif
+
+            delete image;
+        }
+
+        void setSharedMemory(bool enabled) {
+            std::lock_guard<std::mutex> lock(registryMutex);
+#ifdef GB_ROM_MMAP
+            sharedMemory = enabled;
+#else
+            (void)enabled;
+#endif
+        }
+
+        bool isSharedMemory() {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            return sharedMemory;
+        }
+
+        int imageCount() {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            int count = 0;
+            for (RomImage* it = images; it; it = it->next) {
+                count++;
+            }
+            return count;
+        }
+
+        size_t imageBytes() {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            size_t bytes = 0;
+            for (RomImage* it = images; it; it = it->next) {
+                bytes += it->size;
+            }
+            return bytes;
+        }
+
+    }
+}
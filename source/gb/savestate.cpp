@@ -0,0 +1,383 @@
+#include "included/savestate.hpp"
+#include "included/state.hpp"
+#include "included/memory.hpp"
+#include "included/cartridge.hpp"
+#include "included/apu.hpp"
+#include "included/rom_cache.hpp"
+#include <cstring>
+#include <cstddef>
+#include <type_traits>
+
+namespace gb {
+    namespace savestate {
+
+        static const char MAGIC[4] = { 'G', 'B', 'S', 'S' };
+
+        //optional output sections, present when the saving state had them
+        //and the caller asked for them
+        static constexpr uint8_t SECTION_VIDEO = 0x01;
+        static constexpr uint8_t SECTION_AUDIO = 0x02;
+        //stands in for SECTION_AUDIO when the outputs are left out: the sum
+        //of the pending blip deltas, left and right
+        static constexpr uint8_t SECTION_LEVELS = 0x04;
+
+        struct Header {
+            char magic[4];
+            uint32_t version;
+            uint32_t size; //whole state including this header
+            uint64_t romHash;
+            int32_t romSize;
+            int32_t ramSize;
+            int32_t sampleRate; //output rate the blip timing and audio section were taken at
+            MapperType mapper;
+            uint8_t sections;
+            uint8_t reserved[6];
+        };
+
+        //every serialized field is listed below, once, and walked by the
+        //size counter, the writer and the reader alike; values are stored
+        //little endian at the width of their declared type, so the format
+        //does not depend on struct layout, padding or pointer size. Pointer
+        //members are not listed, load keeps the target's own, and so is host
+        //configuration (sync mode, ppu event mode, audio mode, synthesis,
+        //sample rate, block mixing and what follows from the rate: resampler
+        //kernel and step, blip rate). Changing a list changes the format:
+        //bump VERSION with it
+        template<typename A, typename H> static void headerFields(A& a, H& h) {
+            a(h.magic); a(h.version); a(h.size); a(h.romHash);
+            a(h.romSize); a(h.ramSize); a(h.sampleRate); a(h.mapper); a(h.sections); a(h.reserved);
+        }
+
+        template<typename A, typename S> static void cpuFields(A& a, S& cpu) {
+            a(cpu.AF); a(cpu.BC); a(cpu.DE); a(cpu.HL); a(cpu.SP); a(cpu.PC);
+            a(cpu.ime); a(cpu.imeScheduled); a(cpu.halted); a(cpu.interruptPending);
+        }
+
+        template<typename A, typename S> static void schedulerFields(A& a, S& scheduler) {
+            a(scheduler.cycles); a(scheduler.timerDeadline); a(scheduler.ppuDeadline);
+        }
+
+        template<typename A, typename S> static void timerFields(A& a, S& timer) {
+            a(timer.divBase); a(timer.timaSync); a(timer.clockShift); a(timer.enabled);
+        }
+
+        template<typename A, typename S> static void bankFields(A& a, S& cart) {
+            a(cart.romBank); a(cart.ramBank); a(cart.mbcMode); a(cart.ramEnabled);
+        }
+
+        template<typename A, typename S> static void ppuFields(A& a, S& ppu) {
+            a(ppu.frameReady); a(ppu.scanlineCycles); a(ppu.nextEventCycles); a(ppu.lastSync);
+            a(ppu.skippedTicks);
+        }
+
+        template<typename A, typename S> static void joypadFields(A& a, S& joypad) {
+            a(joypad.buttonA); a(joypad.buttonB); a(joypad.buttonStart); a(joypad.buttonSelect);
+            a(joypad.dpadUp); a(joypad.dpadDown); a(joypad.dpadLeft); a(joypad.dpadRight);
+            a(joypad.selectButtons); a(joypad.selectDpad);
+        }
+
+        template<typename A, typename S> static void memoryFields(A& a, S& memory) {
+            a(memory.io); a(memory.hram); a(memory.ie); a(memory.oam); a(memory.vram); a(memory.wram);
+        }
+
+        template<typename A, typename S> static void envelopeFields(A& a, S& ch) {
+            a(ch.volume); a(ch.envelopeTimer); a(ch.envelopePeriod); a(ch.envelopeIncrease);
+        }
+
+        template<typename A, typename S> static void apuFields(A& a, S& apu) {
+            a(apu.bufferPosition); a(apu.sampleCycles); a(apu.frameSequencerCycles); a(apu.frameSequencerStep);
+            a(apu.lastSync);
+
+            a(apu.ch1.enabled); a(apu.ch1.frequency); a(apu.ch1.frequencyTimer);
+            a(apu.ch1.dutyPosition); a(apu.ch1.duty); envelopeFields(a, apu.ch1);
+            a(apu.ch1.sweepTimer); a(apu.ch1.sweepPeriod); a(apu.ch1.sweepNegate); a(apu.ch1.sweepShift);
+            a(apu.ch1.shadowFrequency); a(apu.ch1.lengthCounter);
+
+            a(apu.ch2.enabled); a(apu.ch2.frequency); a(apu.ch2.frequencyTimer);
+            a(apu.ch2.dutyPosition); a(apu.ch2.duty); envelopeFields(a, apu.ch2); a(apu.ch2.lengthCounter);
+
+            a(apu.ch3.enabled); a(apu.ch3.dacEnabled); a(apu.ch3.frequency); a(apu.ch3.frequencyTimer);
+            a(apu.ch3.position); a(apu.ch3.volume); a(apu.ch3.lengthCounter); a(apu.ch3.waveTable);
+
+            a(apu.ch4.enabled); envelopeFields(a, apu.ch4); a(apu.ch4.frequencyTimer);
+            a(apu.ch4.divisor); a(apu.ch4.shiftAmount); a(apu.ch4.widthMode); a(apu.ch4.lfsr);
+            a(apu.ch4.lengthCounter);
+
+            a(apu.masterEnable); a(apu.masterVolumeLeft); a(apu.masterVolumeRight);
+            a(apu.ch1Left); a(apu.ch1Right); a(apu.ch2Left); a(apu.ch2Right);
+            a(apu.ch3Left); a(apu.ch3Right); a(apu.ch4Left); a(apu.ch4Right);
+
+            a(apu.frameClocks); a(apu.channelOutput); a(apu.mixLeft); a(apu.mixRight);
+            a(apu.blockPosition); a(apu.blockSamples);
+
+            //history and position count native rate input frames, they hold
+            //at any output rate
+            a(apu.resampler.history); a(apu.resampler.position);
+
+            //offset is a fraction of an output sample, see load for a target
+            //at another rate
+            a(apu.blipLeft.offset); a(apu.blipLeft.integrator);
+            a(apu.blipRight.offset); a(apu.blipRight.integrator);
+        }
+
+        //everything but the sram and the output sections
+        template<typename A, typename S> static void stateFields(A& a, S& state) {
+            cpuFields(a, state.cpu);
+            schedulerFields(a, state.scheduler);
+            timerFields(a, state.timer);
+            bankFields(a, state.cartridge);
+            ppuFields(a, state.ppu);
+            joypadFields(a, state.joypad);
+            memoryFields(a, state.memory);
+            apuFields(a, state.apu);
+        }
+
+        //integers and enums as their (underlying) width, bools as one byte
+        template<typename T> struct Encoded {
+            typedef typename std::conditional<std::is_enum<T>::value, std::underlying_type<T>,
+                                              std::enable_if<true, T>>::type::type Integer;
+            typedef typename std::make_unsigned<Integer>::type Bits;
+        };
+
+        struct Counter {
+            size_t size;
+
+            template<typename T> void operator()(const T&) { size += sizeof(typename Encoded<T>::Bits); }
+            void operator()(const bool&) { size += 1; }
+            template<typename T, size_t N> void operator()(const T (&values)[N]) {
+                for (size_t i = 0; i < N; i++) (*this)(values[i]);
+            }
+        };
+
+        struct Writer {
+            uint8_t* out;
+
+            template<typename T> void operator()(const T& value) {
+                typedef typename Encoded<T>::Bits Bits;
+                Bits bits = (Bits)value;
+                for (size_t i = 0; i < sizeof(Bits); i++) {
+                    *out++ = (uint8_t)(bits >> (i * 8));
+                }
+            }
+            void operator()(const bool& value) { *out++ = value ? 1 : 0; }
+            void operator()(const char& value) { *out++ = (uint8_t)value; }
+            template<typename T, size_t N> void operator()(const T (&values)[N]) {
+                for (size_t i = 0; i < N; i++) (*this)(values[i]);
+            }
+            template<size_t N> void operator()(const uint8_t (&values)[N]) {
+                memcpy(out, values, N);
+                out += N;
+            }
+        };
+
+        struct Reader {
+            const uint8_t* in;
+
+            template<typename T> void operator()(T& value) {
+                typedef typename Encoded<T>::Bits Bits;
+                Bits bits = 0;
+                for (size_t i = 0; i < sizeof(Bits); i++) {
+                    bits |= (Bits)((Bits)*in++ << (i * 8));
+                }
+                value = (T)bits;
+            }
+            void operator()(bool& value) { value = *in++ != 0; }
+            void operator()(char& value) { value = (char)*in++; }
+            template<typename T, size_t N> void operator()(T (&values)[N]) {
+                for (size_t i = 0; i < N; i++) (*this)(values[i]);
+            }
+            template<size_t N> void operator()(uint8_t (&values)[N]) {
+                memcpy(values, in, N);
+                in += N;
+            }
+        };
+
+        //the output sections, only their element types are needed to size them
+        static constexpr size_t VIDEO_BYTES = sizeof(VideoBuffers::framebuffer);
+        static constexpr size_t SAMPLE_COUNT = sizeof(AudioBuffers::samples) / sizeof(int16_t);
+        static constexpr size_t DELTA_COUNT = BlipState::DELTA_COUNT;
+        static constexpr size_t AUDIO_BYTES = SAMPLE_COUNT * 2 + 2 * DELTA_COUNT * 4;
+        static constexpr size_t LEVELS_BYTES = 2 * 4;
+
+        static size_t headerBytes() {
+            Header header;
+            Counter counter = { 0 };
+            headerFields(counter, header);
+            return counter.size;
+        }
+
+        static uint8_t sectionsOf(const GBState& state, bool outputs) {
+            bool audio = state.apu.audioBuffer && state.apu.blipLeft.deltas;
+            if (!outputs) return audio ? SECTION_LEVELS : 0;
+            return (state.ppu.framebuffer ? SECTION_VIDEO : 0) | (audio ? SECTION_AUDIO : 0);
+        }
+
+        static int32_t pendingLevel(const int32_t* deltas) {
+            int32_t sum = 0;
+            for (size_t i = 0; i < DELTA_COUNT; i++) sum += deltas[i];
+            return sum;
+        }
+
+        static size_t sizeFor(const GBState& state, int ramSize, uint8_t sections) {
+            Counter counter = { 0 };
+            stateFields(counter, state);
+            return headerBytes() + counter.size + ramSize +
+                   ((sections & SECTION_VIDEO) ? VIDEO_BYTES : 0) +
+                   ((sections & SECTION_AUDIO) ? AUDIO_BYTES : 0) +
+                   ((sections & SECTION_LEVELS) ? LEVELS_BYTES : 0);
+        }
+
+        size_t size(const GBState& state, bool outputs) {
+            return sizeFor(state, state.cartridge.ramSize, sectionsOf(state, outputs));
+        }
+
+        size_t save(const GBState& state, uint8_t* buffer, size_t capacity, bool outputs) {
+            const auto& cart = state.cartridge;
+            if (!cart.romImage) return 0;
+
+            uint8_t sections = sectionsOf(state, outputs);
+            size_t total = sizeFor(state, cart.ramSize, sections);
+            if (!buffer || capacity < total) return 0;
+
+            Header header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.version = VERSION;
+            header.size = (uint32_t)total;
+            header.romHash = cart.romImage->hash;
+            header.romSize = cart.romSize;
+            header.ramSize = cart.ramSize;
+            header.sampleRate = state.apu.sampleRate;
+            header.mapper = cart.mapper;
+            header.sections = sections;
+
+            Writer writer = { buffer };
+            headerFields(writer, header);
+            stateFields(writer, state);
+
+            if (cart.ramSize > 0) {
+                memcpy(writer.out, cart.ram, cart.ramSize);
+                writer.out += cart.ramSize;
+            }
+
+            if (sections & SECTION_VIDEO) {
+                memcpy(writer.out, state.ppu.framebuffer, VIDEO_BYTES);
+                writer.out += VIDEO_BYTES;
+            }
+            if (sections & SECTION_AUDIO) {
+                //samples past the write position are stale, zeros keep
+                //consecutive states alike for delta compression
+                int position = state.apu.bufferPosition;
+                if (position < 0) position = 0;
+                if (position > APUState::BUFFER_SIZE) position = APUState::BUFFER_SIZE;
+                size_t used = (size_t)position * 2;
+                for (size_t i = 0; i < SAMPLE_COUNT; i++) {
+                    writer(i < used ? state.apu.audioBuffer[i] : (int16_t)0);
+                }
+                for (size_t i = 0; i < DELTA_COUNT; i++) writer(state.apu.blipLeft.deltas[i]);
+                for (size_t i = 0; i < DELTA_COUNT; i++) writer(state.apu.blipRight.deltas[i]);
+            }
+            if (sections & SECTION_LEVELS) {
+                writer(pendingLevel(state.apu.blipLeft.deltas));
+                writer(pendingLevel(state.apu.blipRight.deltas));
+            }
+
+            return total;
+        }
+
+        bool load(GBState& state, const uint8_t* buffer, size_t size) {
+            auto& cart = state.cartridge;
+
+            Header header;
+            if (!buffer || size < headerBytes() || !cart.romImage) return false;
+            Reader reader = { buffer };
+            headerFields(reader, header);
+
+            if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION) {
+                return false;
+            }
+            if (header.romHash != cart.romImage->hash || header.romSize != cart.romSize ||
+                header.ramSize != cart.ramSize || header.mapper != cart.mapper) {
+                return false;
+            }
+            if (header.size != sizeFor(state, header.ramSize, header.sections) || size < header.size) {
+                return false;
+            }
+
+            stateFields(reader, state);
+
+            //a frame longer than this never happens, apu::tick relies on it
+            if (state.apu.frameClocks > (uint32_t)apu::CYCLES_PER_FRAME) {
+                state.apu.frameClocks = apu::CYCLES_PER_FRAME;
+            }
+
+            if (cart.ramSize > 0) {
+                cartridge::unshareRAM(state);
+                memcpy(cart.ram, reader.in, cart.ramSize);
+                reader.in += cart.ramSize;
+                //the whole sram may have changed, let a save journal see it
+                cartridge::markAllDirty(state);
+            }
+
+            //blip positions and pending output only mean something at the rate
+            //they were taken at; at another rate the next sample starts on the
+            //frame clock, the output levels (integrators) carry over
+            bool sameRate = header.sampleRate == state.apu.sampleRate;
+            if (!sameRate) {
+                state.apu.blipLeft.offset = 0;
+                state.apu.blipRight.offset = 0;
+            }
+            //likewise a pending mix block belongs to the point sampled path
+            if (state.apu.synthesis != AudioSynthesis::POINT) {
+                state.apu.blockPosition = 0;
+            }
+
+            //sections the target has no buffer for are skipped
+            int16_t* audioBuffer = state.apu.audioBuffer;
+            int32_t* deltasLeft = state.apu.blipLeft.deltas;
+            int32_t* deltasRight = state.apu.blipRight.deltas;
+            if (header.sections & SECTION_VIDEO) {
+                if (state.ppu.framebuffer) memcpy(state.ppu.framebuffer, reader.in, VIDEO_BYTES);
+                reader.in += VIDEO_BYTES;
+            }
+            //pending deltas that can not be restored as they were (left out,
+            //or taken at another rate) become one step at the frame start:
+            //the integrators only hold the level up to what was read, without
+            //the rest the output would stay offset for good
+            bool restored = false;
+            int32_t levelLeft = 0;
+            int32_t levelRight = 0;
+            if (header.sections & SECTION_AUDIO) {
+                if (sameRate && audioBuffer && deltasLeft && deltasRight) {
+                    for (size_t i = 0; i < SAMPLE_COUNT; i++) reader(audioBuffer[i]);
+                    for (size_t i = 0; i < DELTA_COUNT; i++) reader(deltasLeft[i]);
+                    for (size_t i = 0; i < DELTA_COUNT; i++) reader(deltasRight[i]);
+                    restored = true;
+                } else {
+                    int32_t delta;
+                    reader.in += SAMPLE_COUNT * 2;
+                    for (size_t i = 0; i < DELTA_COUNT; i++) { reader(delta); levelLeft += delta; }
+                    for (size_t i = 0; i < DELTA_COUNT; i++) { reader(delta); levelRight += delta; }
+                }
+            } else if (header.sections & SECTION_LEVELS) {
+                reader(levelLeft);
+                reader(levelRight);
+            }
+            if (!restored) {
+                //no samples go with the loaded write position
+                state.apu.bufferPosition = 0;
+                if (deltasLeft && deltasRight) {
+                    memset(deltasLeft, 0, DELTA_COUNT * sizeof(int32_t));
+                    memset(deltasRight, 0, DELTA_COUNT * sizeof(int32_t));
+                    deltasLeft[0] = levelLeft;
+                    deltasRight[0] = levelRight;
+                }
+            }
+
+            cartridge::refreshBanks(state);
+            memory::updateInterruptPending(state);
+            return true;
+        }
+
+    }
+}
@@ -1,42 +1,113 @@
 #include "included/timer.hpp"
 #include "included/state.hpp"
+#include "included/memory.hpp"
 
 namespace gb {
     namespace timer {
 
-        static const int clockSelect[] = { 1024, 16, 64, 256 };
+        //TIMA ticks on the falling edge of one counter bit: 1024, 16, 64, 256
+        static const int clockShift[] = { 10, 4, 6, 8 };
+
+        static void reschedule(GBState& state) {
+            auto& timer = state.timer;
+            auto& io = state.memory.io;
+
+            if (!timer.enabled) {
+                state.scheduler.timerDeadline = SchedulerState::NO_DEADLINE;
+                return;
+            }
+
+            //the tick that wraps TIMA, counted from the last one already applied
+            uint64_t ticks = (timer.timaSync - timer.divBase) >> timer.clockShift;
+            ticks += 256 - io[REG_TIMA];
+            state.scheduler.timerDeadline = timer.divBase + (ticks << timer.clockShift);
+        }
+
+        static void advanceTIMA(GBState& state, uint64_t ticks) {
+            auto& io = state.memory.io;
+
+            while (ticks > 0) {
+                uint64_t toOverflow = 256 - io[REG_TIMA];
+                if (ticks < toOverflow) {
+                    io[REG_TIMA] += (uint8_t)ticks;
+                    return;
+                }
+                ticks -= toOverflow;
+                io[REG_TIMA] = io[REG_TMA];
+                memory::requestInterrupt(state, 0x04);
+            }
+        }
 
         void initialize(GBState& state) {
-            state.timer.divCycles = 0;
-            state.timer.timaCycles = 0;
+            auto& timer = state.timer;
+
+            timer.divBase = state.scheduler.cycles;
+            timer.timaSync = state.scheduler.cycles;
+            timer.clockShift = clockShift[0];
+            timer.enabled = false;
+            state.scheduler.timerDeadline = SchedulerState::NO_DEADLINE;
+
+            memory::registerIO(state, REG_DIV, readRegister, writeRegister);
+            memory::registerIO(state, REG_TIMA, readRegister, writeRegister);
+            memory::registerIO(state, REG_TMA, nullptr, writeRegister);
+            memory::registerIO(state, REG_TAC, nullptr, writeRegister);
         }
 
-        void tick(GBState& state, int cycles) {
+        void sync(GBState& state) {
             auto& timer = state.timer;
             auto& io = state.memory.io;
+            uint64_t now = state.scheduler.cycles;
 
-            timer.divCycles += cycles;
-            while (timer.divCycles >= 256) {
-                timer.divCycles -= 256;
-                io[REG_DIV]++;
-            }
+            io[REG_DIV] = (uint8_t)((now - timer.divBase) >> 8);
 
-            if (!(io[REG_TAC] & 0x04)) {
-                return;
+            if (timer.enabled) {
+                uint64_t from = (timer.timaSync - timer.divBase) >> timer.clockShift;
+                uint64_t to = (now - timer.divBase) >> timer.clockShift;
+                advanceTIMA(state, to - from);
             }
+            timer.timaSync = now;
+        }
 
-            int clockDivider = clockSelect[io[REG_TAC] & 0x03];
+        void update(GBState& state) {
+            sync(state);
+            reschedule(state);
+        }
 
-            timer.timaCycles += cycles;
-            while (timer.timaCycles >= clockDivider) {
-                timer.timaCycles -= clockDivider;
-                io[REG_TIMA]++;
+        uint8_t readRegister(GBState& state, uint8_t reg) {
+            sync(state);
+            return state.memory.io[reg];
+        }
+
+        void writeRegister(GBState& state, uint8_t reg, uint8_t value) {
+            auto& timer = state.timer;
+            auto& io = state.memory.io;
+
+            sync(state);
 
-                if (io[REG_TIMA] == 0) {
-                    io[REG_TIMA] = io[REG_TMA];
-                    io[0x0F] |= 0x04;
+            switch (reg) {
+                case REG_DIV: {
+                    //resetting the counter is a falling edge if the selected bit was set
+                    uint64_t counter = state.scheduler.cycles - timer.divBase;
+                    if (timer.enabled && (counter & (1ull << (timer.clockShift - 1)))) {
+                        advanceTIMA(state, 1);
+                    }
+                    timer.divBase = state.scheduler.cycles;
+                    timer.timaSync = state.scheduler.cycles;
+                    io[REG_DIV] = 0;
+                    break;
                 }
+                case REG_TIMA:
+                case REG_TMA:
+                    io[reg] = value;
+                    break;
+                case REG_TAC:
+                    io[REG_TAC] = value;
+                    timer.enabled = value & 0x04;
+                    timer.clockShift = clockShift[value & 0x03];
+                    break;
             }
+
+            reschedule(state);
         }
 
     }
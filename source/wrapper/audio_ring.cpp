@@ -0,0 +1,74 @@
+// audio_ring.cpp
+#include "included/audio_ring.hpp"
+#include <cstring>
+
+AudioRing::AudioRing() {
+    reset();
+}
+
+void AudioRing::reset() {
+    memset(buffer, 0, sizeof(buffer));
+    writePos.store(0, std::memory_order_relaxed);
+    readPos.store(0, std::memory_order_relaxed);
+    overruns.store(0, std::memory_order_relaxed);
+    underruns.store(0, std::memory_order_relaxed);
+}
+
+int AudioRing::write(const int16_t* samples, int frames) {
+    uint32_t w = writePos.load(std::memory_order_relaxed);
+    uint32_t r = readPos.load(std::memory_order_acquire);
+
+    int free = CAPACITY - (int)(w - r);
+    int count = frames < free ? frames : free;
+    if (count < frames) {
+        overruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    //copy in at most two pieces around the wrap point
+    uint32_t start = w & (CAPACITY - 1);
+    int first = CAPACITY - (int)start;
+    if (first > count) first = count;
+    memcpy(&buffer[start * 2], samples, first * 2 * sizeof(int16_t));
+    memcpy(&buffer[0], samples + first * 2, (count - first) * 2 * sizeof(int16_t));
+
+    writePos.store(w + count, std::memory_order_release);
+    return count;
+}
+
+int AudioRing::read(int16_t* out, int frames) {
+    uint32_t r = readPos.load(std::memory_order_relaxed);
+    uint32_t w = writePos.load(std::memory_order_acquire);
+
+    int avail = (int)(w - r);
+    int count = frames < avail ? frames : avail;
+    if (count < frames) {
+        underruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint32_t start = r & (CAPACITY - 1);
+    int first = CAPACITY - (int)start;
+    if (first > count) first = count;
+    memcpy(out, &buffer[start * 2], first * 2 * sizeof(int16_t));
+    memcpy(out + first * 2, &buffer[0], (count - first) * 2 * sizeof(int16_t));
+
+    readPos.store(r + count, std::memory_order_release);
+    return count;
+}
+
+int AudioRing::available() const {
+    uint32_t w = writePos.load(std::memory_order_acquire);
+    uint32_t r = readPos.load(std::memory_order_acquire);
+    return (int)(w - r);
+}
+
+int AudioRing::space() const {
+    return CAPACITY - available();
+}
+
+uint32_t AudioRing::getOverruns() const {
+    return overruns.load(std::memory_order_relaxed);
+}
+
+uint32_t AudioRing::getUnderruns() const {
+    return underruns.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,212 @@
+// audio_sink.cpp
+#include "included/audio_sink.hpp"
+#include <cstring>
+#include <chrono>
+
+AudioSink::AudioSink() : running(false), framesWritten(0), droppedFrames(0), filesWritten(0), error(false),
+                         file(nullptr), fileFrames(0), fileIndex(0), format(Format::WAV), sampleRate(0),
+                         framesPerFile(0) {
+    basePath[0] = '\0';
+}
+
+AudioSink::~AudioSink() {
+    close();
+}
+
+bool AudioSink::open(const char* path, Format format, int sampleRate, uint32_t framesPerFile) {
+    close();
+
+    if (!path || sampleRate <= 0) return false;
+    if (strlen(path) >= sizeof(basePath)) return false;
+
+    strcpy(basePath, path);
+    this->format = format;
+    this->sampleRate = sampleRate;
+    this->framesPerFile = framesPerFile;
+
+    ring.reset();
+    framesWritten.store(0, std::memory_order_relaxed);
+    droppedFrames.store(0, std::memory_order_relaxed);
+    filesWritten.store(0, std::memory_order_relaxed);
+    error.store(false, std::memory_order_relaxed);
+    fileIndex = 0;
+
+    //open the first file here so a bad path is reported to the caller
+    if (!openFile()) return false;
+
+    running.store(true, std::memory_order_release);
+    writer = std::thread(&AudioSink::run, this);
+    return true;
+}
+
+void AudioSink::close() {
+    if (!writer.joinable()) return;
+
+    running.store(false, std::memory_order_release);
+    wake.notify_one();
+    writer.join();
+}
+
+bool AudioSink::isOpen() const {
+    return running.load(std::memory_order_acquire);
+}
+
+int AudioSink::submit(const int16_t* samples, int frames) {
+    if (!running.load(std::memory_order_acquire) || frames <= 0) return 0;
+
+    int written = ring.write(samples, frames);
+    if (written < frames) {
+        droppedFrames.fetch_add(frames - written, std::memory_order_relaxed);
+    }
+
+    //wake early once a good chunk is waiting, otherwise the timeout does it
+    if (ring.available() >= CHUNK_FRAMES) {
+        wake.notify_one();
+    }
+    return written;
+}
+
+uint64_t AudioSink::getFramesWritten() const {
+    return framesWritten.load(std::memory_order_relaxed);
+}
+
+uint32_t AudioSink::getDroppedFrames() const {
+    return droppedFrames.load(std::memory_order_relaxed);
+}
+
+uint32_t AudioSink::getFilesWritten() const {
+    return filesWritten.load(std::memory_order_relaxed);
+}
+
+bool AudioSink::hasError() const {
+    return error.load(std::memory_order_relaxed);
+}
+
+void AudioSink::run() {
+    while (running.load(std::memory_order_acquire)) {
+        {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wake.wait_for(lock, std::chrono::milliseconds(20));
+        }
+        drain();
+    }
+
+    //producer has stopped, flush the tail
+    drain();
+    closeFile();
+}
+
+void AudioSink::drain() {
+    while (file) {
+        int count = ring.available();
+        if (count <= 0) break;
+        if (count > CHUNK_FRAMES) count = CHUNK_FRAMES;
+
+        //never let a chunk cross a rotation point
+        if (framesPerFile > 0 && count > (int)(framesPerFile - fileFrames)) {
+            count = framesPerFile - fileFrames;
+        }
+
+        ring.read(chunk, count);
+
+        //samples go out little endian whatever the host is
+        const uint16_t probe = 1;
+        if (*(const uint8_t*)&probe == 0) {
+            for (int i = 0; i < count * 2; i++) {
+                uint16_t s = (uint16_t)chunk[i];
+                chunk[i] = (int16_t)((s >> 8) | (s << 8));
+            }
+        }
+
+        if (fwrite(chunk, 4, count, file) != (size_t)count) {
+            error.store(true, std::memory_order_relaxed);
+            closeFile();
+            return;
+        }
+
+        fileFrames += count;
+        framesWritten.fetch_add(count, std::memory_order_relaxed);
+
+        if (framesPerFile > 0 && fileFrames >= framesPerFile) {
+            closeFile();
+            if (!openFile()) return;
+        }
+    }
+}
+
+bool AudioSink::openFile() {
+    char path[sizeof(basePath) + 16];
+
+    if (framesPerFile > 0) {
+        //insert the index in front of the extension
+        const char* dot = strrchr(basePath, '.');
+        const char* slash = strrchr(basePath, '/');
+        if (!dot || (slash && dot < slash)) dot = basePath + strlen(basePath);
+        int stem = (int)(dot - basePath);
+        snprintf(path, sizeof(path), "%.*s_%04u%s", stem, basePath, (unsigned)(fileIndex + 1), dot);
+    } else {
+        strcpy(path, basePath);
+    }
+
+    file = fopen(path, "wb");
+    if (!file) {
+        error.store(true, std::memory_order_relaxed);
+        return false;
+    }
+    setvbuf(file, fileBuffer, _IOFBF, sizeof(fileBuffer));
+
+    fileFrames = 0;
+    fileIndex++;
+
+    //placeholder sizes, patched when the file is closed
+    if (format == Format::WAV) {
+        writeHeader(0);
+    }
+    return true;
+}
+
+void AudioSink::closeFile() {
+    if (!file) return;
+
+    if (format == Format::WAV) {
+        fseek(file, 0, SEEK_SET);
+        writeHeader(fileFrames);
+    }
+
+    fclose(file);
+    file = nullptr;
+    filesWritten.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AudioSink::writeHeader(uint32_t frames) {
+    uint8_t header[WAV_HEADER_SIZE];
+    uint32_t dataSize = frames * 4;
+    uint32_t byteRate = (uint32_t)sampleRate * 4;
+
+    auto put16 = [&](int offset, uint16_t value) {
+        header[offset] = value & 0xFF;
+        header[offset + 1] = value >> 8;
+    };
+    auto put32 = [&](int offset, uint32_t value) {
+        put16(offset, value & 0xFFFF);
+        put16(offset + 2, value >> 16);
+    };
+
+    memcpy(header, "RIFF", 4);
+    put32(4, 36 + dataSize);
+    memcpy(header + 8, "WAVE", 4);
+    memcpy(header + 12, "fmt ", 4);
+    put32(16, 16); //pcm fmt chunk size
+    put16(20, 1); //pcm
+    put16(22, 2); //stereo
+    put32(24, sampleRate);
+    put32(28, byteRate);
+    put16(32, 4); //block align
+    put16(34, 16); //bits per sample
+    memcpy(header + 36, "data", 4);
+    put32(40, dataSize);
+
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+        error.store(true, std::memory_order_relaxed);
+    }
+}
@@ -7,16 +7,86 @@
 #include "../gb/included/timer.hpp"
 #include "../gb/included/joypad.hpp"
 #include "../gb/included/cartridge.hpp"
+#include "../gb/included/layout.hpp"
+#include "../gb/included/buffers.hpp"
+#include "../gb/included/rom_cache.hpp"
+#include "../gb/included/savestate.hpp"
+#include <new>
+#include <cstring>
+#include <cstdlib>
 
-GameBoy::GameBoy() : romLoaded(false) {
+GameBoy::GameBoy() : romLoaded(false), stepCPU(gb::cpu::stepFor(gb::MapperType::NONE)), audioRing(nullptr), audioRingEnabled(false), audioSink(nullptr),
+                     audioSinkPosition(0), sramJournal(nullptr), rewindBuffer(nullptr) {
     input.clear();
+    gb::buffers::initialize(state);
+    //set once here, init and reset keep whatever setSyncMode chose
+    state.scheduler.syncMode = gb::SyncMode::CATCH_UP;
+    //the destructor releases the cartridge, even if init never ran
+    gb::cartridge::initialize(state);
 }
 
 GameBoy::~GameBoy() {
+    disableSRAMJournal();
     gb::cartridge::cleanup(state);
+    gb::buffers::cleanup(state);
+    delete audioRing;
+    delete rewindBuffer;
+}
+
+//over allocate and keep what malloc returned just below the object
+static void* allocateAligned(size_t size) {
+    void* block = malloc(size + alignof(GameBoy) + sizeof(void*));
+    if (!block) return nullptr;
+
+    uintptr_t aligned = ((uintptr_t)block + sizeof(void*) + alignof(GameBoy) - 1) & ~(uintptr_t)(alignof(GameBoy) - 1);
+    reinterpret_cast<void**>(aligned)[-1] = block;
+    return reinterpret_cast<void*>(aligned);
+}
+
+static void freeAligned(void* pointer) {
+    if (pointer) {
+        free(reinterpret_cast<void**>(pointer)[-1]);
+    }
+}
+
+void* GameBoy::operator new(size_t size) noexcept {
+    return allocateAligned(size);
+}
+
+void* GameBoy::operator new(size_t size, const std::nothrow_t&) noexcept {
+    return allocateAligned(size);
+}
+
+void* GameBoy::operator new[](size_t size) noexcept {
+    return allocateAligned(size);
+}
+
+void* GameBoy::operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return allocateAligned(size);
+}
+
+void GameBoy::operator delete(void* pointer) noexcept {
+    freeAligned(pointer);
+}
+
+void GameBoy::operator delete(void* pointer, const std::nothrow_t&) noexcept {
+    freeAligned(pointer);
+}
+
+void GameBoy::operator delete[](void* pointer) noexcept {
+    freeAligned(pointer);
+}
+
+void GameBoy::operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+    freeAligned(pointer);
 }
 
 void GameBoy::init() {
+    //the cartridge holds a rom cache reference and the sram, give them back
+    //before the fields are cleared (the constructor did the first clear)
+    disableSRAMJournal();
+    gb::cartridge::cleanup(state);
+
     gb::cpu::initialize(state);
     gb::memory::initialize(state);
     gb::cartridge::initialize(state);
@@ -25,7 +95,11 @@ void GameBoy::init() {
     gb::joypad::initialize(state);
     gb::apu::initialize(state);
     romLoaded = false;
+    stepCPU = gb::cpu::stepFor(gb::MapperType::NONE);
     input.clear();
+    if (rewindBuffer) {
+        rewindBuffer->reset();
+    }
 }
 
 void GameBoy::reset() {
@@ -34,30 +108,78 @@ void GameBoy::reset() {
 
 void GameBoy::runFrame() {
     if (!romLoaded) return;
-    
+
+    if (rewindBuffer) {
+        rewindBuffer->recordInput(getInputState());
+    }
+
+    emulateFrame();
+
+    //only the new part, callers may leave the buffer filling across frames
+    if (audioSink && state.apu.audioBuffer) {
+        if (audioSinkPosition > state.apu.bufferPosition) audioSinkPosition = 0;
+        audioSink->submit(&state.apu.audioBuffer[audioSinkPosition * 2], state.apu.bufferPosition - audioSinkPosition);
+        audioSinkPosition = state.apu.bufferPosition;
+    }
+
+    if (audioRingEnabled && state.apu.audioBuffer) {
+        audioRing->write(state.apu.audioBuffer, state.apu.bufferPosition);
+        state.apu.bufferPosition = 0;
+        audioSinkPosition = 0;
+    }
+
+    if (sramJournal) {
+        submitSRAMPages();
+    }
+
+    if (rewindBuffer) {
+        rewindBuffer->endFrame(state);
+    }
+}
+
+void GameBoy::emulateFrame() {
     updateInput();
     state.ppu.frameReady = false;
     
     while (!state.ppu.frameReady) {
         step();
     }
+
+    gb::apu::catchUp(state);
+    gb::apu::endFrame(state);
 }
 
 void GameBoy::step() {
-    int cycles = gb::cpu::step(state);
-    gb::ppu::tick(state, cycles);
-    gb::timer::tick(state, cycles);
-    gb::apu::tick(state, cycles);
+    int cycles = stepCPU(state);
+    auto& scheduler = state.scheduler;
+    scheduler.cycles += cycles;
+
+    if (scheduler.syncMode == gb::SyncMode::LOCKSTEP) {
+        gb::ppu::catchUp(state);
+    } else if (scheduler.cycles >= scheduler.ppuDeadline) {
+        gb::ppu::catchUp(state);
+    }
+
+    if (scheduler.cycles >= scheduler.timerDeadline) {
+        gb::timer::update(state);
+    }
+
+    //in catch up mode the apu only runs on register access and at frame end
+    if (scheduler.syncMode == gb::SyncMode::LOCKSTEP) {
+        gb::apu::catchUp(state);
+    }
     handleInterrupts();
 }
 
 void GameBoy::handleInterrupts() {
+    if (!state.cpu.interruptPending) return;
+
+    //any pending interrupt ends halt, even with ime off
+    state.cpu.halted = false;
+
     if (!state.cpu.ime) return;
-    
+
     uint8_t pending = state.memory.io[gb::memory::IO_IF] & state.memory.ie & 0x1F;
-    if (pending == 0) return;
-    
-    state.cpu.halted = false;
     
     uint16_t handler = 0;
     uint8_t bit = 0;
@@ -70,7 +192,7 @@ void GameBoy::handleInterrupts() {
     
     if (handler) {
         state.cpu.ime = false;
-        state.memory.io[gb::memory::IO_IF] &= ~bit;
+        gb::memory::clearInterrupt(state, bit);
         state.cpu.SP--;
         gb::memory::write(state, state.cpu.SP, state.cpu.PC >> 8);
         state.cpu.SP--;
@@ -80,7 +202,13 @@ void GameBoy::handleInterrupts() {
 }
 
 bool GameBoy::loadROM(const char* filepath) {
+    //the journal belongs to the sram about to be freed
+    disableSRAMJournal();
     romLoaded = gb::cartridge::loadRom(state, filepath);
+    stepCPU = gb::cpu::stepFor(state.cartridge.mapper);
+    if (rewindBuffer) {
+        rewindBuffer->reset();
+    }
     return romLoaded;
 }
 
@@ -95,7 +223,30 @@ void GameBoy::updateInput() {
     gb::joypad::setButton(state, gb::joypad::BTN_RIGHT, input.right);
 }
 
+bool GameBoy::isROMLoaded() const {
+    return romLoaded;
+}
+
+uint8_t GameBoy::getInputState() const {
+    return (input.a << gb::joypad::BTN_A) | (input.b << gb::joypad::BTN_B) |
+           (input.select << gb::joypad::BTN_SELECT) | (input.start << gb::joypad::BTN_START) |
+           (input.right << gb::joypad::BTN_RIGHT) | (input.left << gb::joypad::BTN_LEFT) |
+           (input.up << gb::joypad::BTN_UP) | (input.down << gb::joypad::BTN_DOWN);
+}
+
+void GameBoy::setInputState(uint8_t state) {
+    input.a = state & (1 << gb::joypad::BTN_A);
+    input.b = state & (1 << gb::joypad::BTN_B);
+    input.select = state & (1 << gb::joypad::BTN_SELECT);
+    input.start = state & (1 << gb::joypad::BTN_START);
+    input.right = state & (1 << gb::joypad::BTN_RIGHT);
+    input.left = state & (1 << gb::joypad::BTN_LEFT);
+    input.up = state & (1 << gb::joypad::BTN_UP);
+    input.down = state & (1 << gb::joypad::BTN_DOWN);
+}
+
 uint8_t* GameBoy::getFramebuffer() {
+    gb::buffers::attachVideo(state);
     return state.ppu.framebuffer;
 }
 
@@ -111,7 +262,22 @@ void GameBoy::clearFrameReady() {
     state.ppu.frameReady = false;
 }
 
+void GameBoy::setPPUEventDriven(bool enabled) {
+    gb::ppu::setEventDriven(state, enabled);
+}
+
+void GameBoy::setSyncMode(gb::SyncMode mode) {
+    gb::ppu::catchUp(state);
+    gb::apu::catchUp(state);
+    state.scheduler.syncMode = mode;
+}
+
+uint32_t GameBoy::getPPUSkippedTicks() const {
+    return state.ppu.skippedTicks;
+}
+
 int16_t* GameBoy::getAudioBuffer() {
+    gb::buffers::attachAudio(state);
     return state.apu.audioBuffer;
 }
 
@@ -121,18 +287,266 @@ int GameBoy::getAudioBufferPosition() const {
 
 void GameBoy::clearAudioBuffer() {
     state.apu.bufferPosition = 0;
+    audioSinkPosition = 0;
+}
+
+void GameBoy::setAudioMode(gb::AudioMode mode) {
+    gb::apu::setMode(state, mode);
+
+    //only full mode produces samples, the others can drop the buffers
+    if (mode == gb::AudioMode::FULL) {
+        gb::buffers::attachAudio(state);
+    } else {
+        gb::buffers::detachAudio(state);
+    }
+}
+
+void GameBoy::setVideoEnabled(bool enabled) {
+    if (enabled) {
+        gb::buffers::attachVideo(state);
+    } else {
+        gb::buffers::detachVideo(state);
+    }
+}
+
+void GameBoy::setSampleRate(int sampleRate) {
+    gb::apu::setSampleRate(state, sampleRate);
+}
+
+int GameBoy::getSampleRate() const {
+    return state.apu.sampleRate;
+}
+
+void GameBoy::setAudioSynthesis(gb::AudioSynthesis synthesis) {
+    gb::apu::setSynthesis(state, synthesis);
+}
+
+void GameBoy::setAudioBlockMixing(bool enabled) {
+    gb::apu::setBlockMixing(state, enabled);
+}
+
+void GameBoy::setAudioSink(AudioSink* sink) {
+    if (sink) {
+        gb::buffers::attachAudio(state);
+    }
+    audioSink = sink;
+    audioSinkPosition = state.apu.bufferPosition;
+}
+
+void GameBoy::enableAudioRing(bool enabled) {
+    if (enabled && !audioRingEnabled) {
+        //allocated on first use and kept until destruction, so a reader
+        //thread never sees it go away
+        if (!audioRing) {
+            audioRing = new (std::nothrow) AudioRing;
+            if (!audioRing) return;
+        }
+        audioRing->reset();
+        gb::buffers::attachAudio(state);
+    }
+    audioRingEnabled = enabled;
+}
+
+int GameBoy::readAudio(int16_t* out, int frames) {
+    return audioRing ? audioRing->read(out, frames) : 0;
+}
+
+int GameBoy::getAudioAvailable() const {
+    return audioRing ? audioRing->available() : 0;
+}
+
+uint32_t GameBoy::getAudioOverruns() const {
+    return audioRing ? audioRing->getOverruns() : 0;
+}
+
+uint32_t GameBoy::getAudioUnderruns() const {
+    return audioRing ? audioRing->getUnderruns() : 0;
 }
 
 bool GameBoy::hasSRAM() const {
     return state.cartridge.ramSize > 0;
 }
 
+bool GameBoy::saveSRAM(const char* filepath) {
+    if (!state.cartridge.ram) return false;
+    return SaveJournal::writeImage(filepath, state.cartridge.ram, state.cartridge.ramSize);
+}
+
+bool GameBoy::loadSRAM(const char* filepath) {
+    if (!state.cartridge.ram) return false;
+    gb::cartridge::unshareRAM(state);
+    if (!SaveJournal::readImage(filepath, state.cartridge.ram, state.cartridge.ramSize)) return false;
+
+    //a journal already running has to pick the loaded sram up
+    gb::cartridge::markAllDirty(state);
+    return true;
+}
+
+bool GameBoy::enableSRAMJournal(const char* filepath, int debounceMs) {
+    disableSRAMJournal();
+    if (!state.cartridge.ram) return false;
+
+    //pages written before now are in the base the journal starts from
+    uint64_t dirty[gb::CartridgeState::RAM_DIRTY_WORDS];
+    gb::cartridge::takeDirtyPages(state, dirty);
+
+    sramJournal = new SaveJournal();
+    if (!sramJournal->open(filepath, state.cartridge.ram, state.cartridge.ramSize, debounceMs)) {
+        delete sramJournal;
+        sramJournal = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void GameBoy::disableSRAMJournal() {
+    if (!sramJournal) return;
+
+    submitSRAMPages();
+    delete sramJournal; //closing flushes and folds the journal in
+    sramJournal = nullptr;
+}
+
+const SaveJournal* GameBoy::getSRAMJournal() const {
+    return sramJournal;
+}
+
+void GameBoy::submitSRAMPages() {
+    uint64_t dirty[gb::CartridgeState::RAM_DIRTY_WORDS];
+    if (gb::cartridge::takeDirtyPages(state, dirty)) {
+        sramJournal->submit(state.cartridge.ram, dirty);
+    }
+}
+
 const char* GameBoy::getROMTitle() const {
     return state.cartridge.title;
 }
 
+size_t GameBoy::getStateSize() const {
+    return gb::savestate::size(state);
+}
+
+size_t GameBoy::saveState(void* buffer, size_t size) const {
+    return gb::savestate::save(state, static_cast<uint8_t*>(buffer), size);
+}
+
+bool GameBoy::loadState(const void* buffer, size_t size) {
+    if (!romLoaded) return false;
+    if (!gb::savestate::load(state, static_cast<const uint8_t*>(buffer), size)) return false;
+
+    //the logged inputs led somewhere else
+    if (rewindBuffer) {
+        rewindBuffer->reset();
+    }
+    return true;
+}
+
+bool GameBoy::enableRewind(size_t capacityBytes, int interval) {
+    if (!rewindBuffer) {
+        rewindBuffer = new (std::nothrow) RewindBuffer;
+        if (!rewindBuffer) return false;
+    }
+    if (!rewindBuffer->configure(capacityBytes, interval)) {
+        disableRewind();
+        return false;
+    }
+    return true;
+}
+
+void GameBoy::disableRewind() {
+    delete rewindBuffer;
+    rewindBuffer = nullptr;
+}
+
+int GameBoy::rewind(int frames) {
+    if (!rewindBuffer || !romLoaded) return 0;
+
+    const uint8_t* snapshot;
+    size_t snapshotSize;
+    const uint8_t* replay;
+    int replayFrames;
+    int back = rewindBuffer->seek(frames, snapshot, snapshotSize, replay, replayFrames);
+    if (back == 0) return 0;
+
+    if (!gb::savestate::load(state, snapshot, snapshotSize)) {
+        rewindBuffer->reset();
+        return 0;
+    }
+
+    //the seek already logged these inputs, replaying must not log them again
+    Input live = input;
+    for (int i = 0; i < replayFrames; i++) {
+        setInputState(replay[i]);
+        emulateFrame();
+    }
+    input = live;
+
+    //the replay's samples were heard the first time round
+    state.apu.bufferPosition = 0;
+    audioSinkPosition = 0;
+    return back;
+}
+
+RewindBuffer::Stats GameBoy::getRewindStats() const {
+    if (rewindBuffer) return rewindBuffer->getStats();
+
+    RewindBuffer::Stats stats;
+    memset(&stats, 0, sizeof(stats));
+    return stats;
+}
+
+GameBoy* GameBoy::clone(CloneReport* report) {
+    if (!romLoaded) return nullptr;
+
+    GameBoy* copy = new GameBoy;
+    if (!copy) return nullptr;
+
+    //everything in the state is plain data; what points at per instance
+    //storage is re-bound below, the io handlers are free functions and stay
+    copy->state = state;
+
+    CloneReport copied;
+    copied.state = sizeof(gb::GBState);
+    copied.buffers = gb::buffers::copy(copy->state, state);
+    copied.cartridge = gb::cartridge::share(copy->state, state);
+    copied.sharedSRAM = state.cartridge.ramSize;
+    copied.total = copied.state + copied.buffers + copied.cartridge;
+
+    copy->romLoaded = romLoaded;
+    copy->stepCPU = stepCPU;
+    copy->input = input;
+    if (report) {
+        *report = copied;
+    }
+    return copy;
+}
+
 bool GameBoy::loadOpcodeTable(const char* filepath) {
     return gb::opcode_parser::parse(filepath, state.opcodes);
 }
 
-// ... rest stays same ...
\ No newline at end of file
+int GameBoy::getLayoutReport(char* buffer, size_t size) const {
+    return gb::layout::report(buffer, size);
+}
+
+GameBoy::MemoryUsage GameBoy::getMemoryUsage() const {
+    MemoryUsage usage;
+
+    usage.state = sizeof(gb::GBState);
+    usage.buffers = gb::buffers::heapBytes(state);
+    usage.cartridge = (size_t)state.cartridge.ramSize +
+                      (state.cartridge.ramDirty ? gb::CartridgeState::RAM_DIRTY_WORDS * sizeof(uint64_t) : 0);
+    usage.sharedROM = state.cartridge.romImage ? (size_t)state.cartridge.romSize : 0;
+    usage.wrapper = sizeof(GameBoy) - sizeof(gb::GBState) + (audioRing ? sizeof(AudioRing) : 0) +
+                    (rewindBuffer ? sizeof(RewindBuffer) + rewindBuffer->getStats().memoryBytes : 0);
+    usage.total = usage.state + usage.buffers + usage.cartridge + usage.wrapper;
+    return usage;
+}
+
+void GameBoy::setSharedROMCache(bool enabled) {
+    gb::romcache::setSharedMemory(enabled);
+}
+
+size_t GameBoy::getROMCacheBytes() {
+    return gb::romcache::imageBytes();
+}
@@ -0,0 +1,42 @@
+#ifndef WRAPPER_AUDIO_RING_HPP
+#define WRAPPER_AUDIO_RING_HPP
+
+#include <cstdint>
+#include <atomic>
+
+//lock free single producer / single consumer ring of stereo frames
+//the emulation thread writes, the audio thread reads; each position is only
+//ever stored by its own side so no locks are needed
+class AudioRing {
+public:
+    static constexpr int CAPACITY = 8192; //stereo frames, power of two
+
+    AudioRing();
+
+    //drop everything and zero the counters, only while no thread is reading
+    void reset();
+
+    //producer: returns frames written, the rest is dropped as an overrun
+    int write(const int16_t* samples, int frames);
+
+    //consumer: returns frames read, a short read counts as an underrun
+    int read(int16_t* out, int frames);
+
+    int available() const;
+    int space() const;
+
+    uint32_t getOverruns() const;
+    uint32_t getUnderruns() const;
+
+private:
+    int16_t buffer[CAPACITY * 2];
+
+    //free running frame counters, masked on access; kept on their own
+    //cache lines so the two threads do not fight over them
+    alignas(64) std::atomic<uint32_t> writePos;
+    std::atomic<uint32_t> overruns;
+    alignas(64) std::atomic<uint32_t> readPos;
+    std::atomic<uint32_t> underruns;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef WRAPPER_AUDIO_SINK_HPP
+#define WRAPPER_AUDIO_SINK_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "audio_ring.hpp"
+
+//streams stereo frames to wav or raw pcm files from a background thread
+//the emulation side only copies into a lock free ring and never touches the
+//file; the writer thread drains it in large buffered writes
+class AudioSink {
+public:
+    enum class Format {
+        WAV,
+        RAW //interleaved little endian int16, no header
+    };
+
+    AudioSink();
+    ~AudioSink();
+
+    //framesPerFile > 0 rotates to path_0001.wav, path_0002.wav, ... every
+    //framesPerFile stereo frames; 0 keeps everything in path
+    bool open(const char* path, Format format, int sampleRate, uint32_t framesPerFile = 0);
+
+    //drains what is left, patches the wav header and joins the thread
+    void close();
+
+    bool isOpen() const;
+
+    //producer: never blocks, frames that do not fit are dropped and counted
+    int submit(const int16_t* samples, int frames);
+
+    uint64_t getFramesWritten() const;
+    uint32_t getDroppedFrames() const;
+    uint32_t getFilesWritten() const;
+    bool hasError() const;
+
+private:
+    static constexpr int CHUNK_FRAMES = 4096;
+    static constexpr int FILE_BUFFER_SIZE = 64 * 1024;
+    static constexpr int WAV_HEADER_SIZE = 44;
+
+    AudioRing ring;
+
+    std::thread writer;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::atomic<bool> running;
+
+    std::atomic<uint64_t> framesWritten;
+    std::atomic<uint32_t> droppedFrames;
+    std::atomic<uint32_t> filesWritten;
+    std::atomic<bool> error;
+
+    //only touched by the writer thread while it runs
+    FILE* file;
+    char fileBuffer[FILE_BUFFER_SIZE];
+    int16_t chunk[CHUNK_FRAMES * 2];
+    uint32_t fileFrames;
+    uint32_t fileIndex;
+
+    char basePath[256];
+    Format format;
+    int sampleRate;
+    uint32_t framesPerFile;
+
+    void run();
+    void drain();
+    bool openFile();
+    void closeFile();
+    void writeHeader(uint32_t frames);
+};
+
+#endif
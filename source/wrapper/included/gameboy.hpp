@@ -3,13 +3,19 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <new>
 
 #include "../gb/included/state.hpp"
+#include "../gb/included/cpu.hpp"
+#include "audio_ring.hpp"
+#include "audio_sink.hpp"
+#include "save_journal.hpp"
+#include "rewind_buffer.hpp"
 
 constexpr int GB_SCREEN_WIDTH = 160;
 constexpr int GB_SCREEN_HEIGHT = 144;
 
-constexpr int GB_SAMPLE_RATE = 32768;
+constexpr int GB_SAMPLE_RATE = 32768; //default, see setSampleRate
 constexpr int GB_AUDIO_BUFFER_SIZE = 2048;
 
 class GameBoy {
@@ -17,12 +23,23 @@ public:
     GameBoy();
     ~GameBoy();
 
+    //GBState is cache line aligned, plain new only honours that from c++17;
+    //every form returns nullptr on failure instead of throwing
+    static void* operator new(size_t size) noexcept;
+    static void* operator new(size_t size, const std::nothrow_t&) noexcept;
+    static void* operator new[](size_t size) noexcept;
+    static void* operator new[](size_t size, const std::nothrow_t&) noexcept;
+    static void operator delete(void* pointer) noexcept;
+    static void operator delete(void* pointer, const std::nothrow_t&) noexcept;
+    static void operator delete[](void* pointer) noexcept;
+    static void operator delete[](void* pointer, const std::nothrow_t&) noexcept;
+
     void init();
     void reset();
     void runFrame();
     void step();
 
-    bool loadROM(const char* filepath);
+    bool loadROM(const char* filepath); //raw image, .gz or .zip; a raw file may be mapped, keep it unchanged while loaded
     bool isROMLoaded() const;
     const char* getROMTitle() const;
 
@@ -42,28 +59,139 @@ public:
         }
     } input;
 
+    //packed in joypad bit order: a, b, select, start, right, left, up, down
     uint8_t getInputState() const;
     void setInputState(uint8_t state);
 
+    //the non const getters attach their buffer on first use; in compact
+    //builds (GB_COMPACT_STATE) a headless instance never allocates them and
+    //the const getter returns nullptr until then, as it does in any build
+    //after setVideoEnabled(false)
     uint8_t* getFramebuffer();
     const uint8_t* getFramebuffer() const;
+    void setVideoEnabled(bool enabled); //off skips rendering (and unbinds the framebuffer)
 
     bool isFrameReady() const;
     void clearFrameReady();
 
+    //event driven ppu (on by default) and how many ticks it short circuited
+    void setPPUEventDriven(bool enabled);
+    uint32_t getPPUSkippedTicks() const;
+
+    //catch up (default) or lockstep subsystem sync, for A/B verification
+    void setSyncMode(gb::SyncMode mode);
+
     int16_t* getAudioBuffer();
     int getAudioBufferPosition() const;
     void clearAudioBuffer();
 
+    //full (default), register only (NR52 / lengths / envelopes kept, no
+    //samples) or off; headless runs that discard audio want register only
+    void setAudioMode(gb::AudioMode mode);
+
+    //output rate of this instance, resampled inside the apu
+    void setSampleRate(int sampleRate);
+    int getSampleRate() const;
+
+    //band limited (default) or point sampled mixing
+    void setAudioSynthesis(gb::AudioSynthesis synthesis);
+    void setAudioBlockMixing(bool enabled); //point sampled only, on by default
+
+    //lock free ring for an audio thread: once enabled every runFrame moves
+    //its samples from the audio buffer into the ring, readAudio can then be
+    //called from another thread concurrently with emulation (enable before
+    //starting that thread, the ring is allocated here)
+    void enableAudioRing(bool enabled);
+    int readAudio(int16_t* out, int frames);
+    int getAudioAvailable() const;
+    uint32_t getAudioOverruns() const;
+    uint32_t getAudioUnderruns() const;
+
+    //every runFrame also hands its samples to the sink (not owned, nullptr
+    //detaches); the sink writes them to disk on its own thread
+    void setAudioSink(AudioSink* sink);
+
     bool hasSRAM() const;
-    bool saveSRAM(const char* filepath);
-    bool loadSRAM(const char* filepath);
+    bool saveSRAM(const char* filepath); //whole image, atomically replaces the file
+    bool loadSRAM(const char* filepath); //also replays a journal left next to it
+
+    //keeps filepath current in the background: every runFrame hands the sram
+    //pages written during it to a journal thread (see SaveJournal); call
+    //loadSRAM first to resume an existing save. Ends on disable, loadROM or
+    //destruction, each of which flushes everything
+    bool enableSRAMJournal(const char* filepath, int debounceMs = 500);
+    void disableSRAMJournal();
+    const SaveJournal* getSRAMJournal() const; //nullptr while disabled
+
+    //whole machine snapshots into caller memory (see gb/savestate.hpp); a
+    //state only loads into an instance running the same rom. saveState
+    //returns the bytes written, 0 if size is below getStateSize()
+    size_t getStateSize() const;
+    size_t saveState(void* buffer, size_t size) const;
+    bool loadState(const void* buffer, size_t size);
+
+    //rewind history (see RewindBuffer): every runFrame logs its input and
+    //each interval frames the state is snapshotted into a ring of
+    //capacityBytes; dropped on loadROM and loadState
+    bool enableRewind(size_t capacityBytes = 4 * 1024 * 1024, int interval = 10);
+    void disableRewind();
+    //goes back up to frames frames by restoring the nearest snapshot and
+    //replaying the logged inputs (audio and video of the replay are not
+    //output); returns the frames gone back, 0 with no history
+    int rewind(int frames);
+    RewindBuffer::Stats getRewindStats() const; //zeroed while disabled
+
+    //independent copy of this instance at this point, for branching
+    //searches; nullptr without a rom. The rom image is shared (another cache
+    //reference) and so is the sram, copy on write: whichever side writes it
+    //first takes its own copy. Everything else in GBState is copied, the
+    //opcode table included. Outputs (audio ring and sink, sram journal,
+    //rewind history) are not carried over
+    struct CloneReport {
+        size_t state; //GBState, with inline buffers and the opcode table
+        size_t buffers; //heap video / audio buffers (compact builds)
+        size_t cartridge; //dirty page bitmap
+        size_t sharedSRAM; //not copied now, copied on the first sram write
+        size_t total; //bytes copied by this call
+    };
+    GameBoy* clone(CloneReport* report = nullptr);
 
     bool loadOpcodeTable(const char* filepath);
 
+    //offset / size / cache line of each part of the emulator state
+    int getLayoutReport(char* buffer, size_t size) const;
+
+    //bytes this instance holds, by owner
+    struct MemoryUsage {
+        size_t state; //GBState, including inline buffers in default builds
+        size_t buffers; //video / audio buffers allocated on demand (compact builds)
+        size_t cartridge; //sram (also when shared with clones) and its dirty page bitmap
+        size_t sharedROM; //rom image, shared through the rom cache and not in total
+        size_t wrapper; //GameBoy itself beyond the state, plus the audio ring and rewind history
+        size_t total;
+    };
+    MemoryUsage getMemoryUsage() const;
+
+    //instances loading the same rom share one image; with shared memory on,
+    //so do separate processes (POSIX hosts). Affects roms loaded afterwards
+    static void setSharedROMCache(bool enabled);
+    //distinct rom images held by this process, each counted once
+    static size_t getROMCacheBytes();
+
 private:
     gb::GBState state;
     bool romLoaded;
+    gb::cpu::StepFunction stepCPU; //core instantiated for the loaded rom's mapper
+
+    AudioRing* audioRing;
+    bool audioRingEnabled;
+    AudioSink* audioSink;
+    int audioSinkPosition; //frames of the audio buffer already submitted
+    SaveJournal* sramJournal;
+    RewindBuffer* rewindBuffer;
+
+    void submitSRAMPages();
+    void emulateFrame(); //input, cpu until vblank, audio frame end; no outputs
 
     void updateInput();
     void handleInterrupts();
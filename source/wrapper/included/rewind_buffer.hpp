@@ -0,0 +1,102 @@
+#ifndef WRAPPER_REWIND_BUFFER_HPP
+#define WRAPPER_REWIND_BUFFER_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+#include "../gb/included/state.hpp"
+
+//rewind history in a fixed amount of memory
+//every interval frames the machine is snapshotted (savestate format, without
+//the framebuffer and pending audio output); only the newest snapshot is kept
+//whole, each older one is stored as the xor against its successor, run
+//length coded, next to the joypad inputs of the
+//frames it covers. Records live in a byte ring that drops the oldest when
+//full. Going back rebuilds the nearest snapshot at or before the target by
+//undoing deltas newest first, the caller then replays the logged inputs
+class RewindBuffer {
+public:
+    static constexpr int MAX_INTERVAL = 600;
+    static constexpr int MAX_RECORDS = 8192;
+
+    struct Stats {
+        int snapshots; //delta records plus the newest full snapshot
+        uint32_t framesAvailable; //how far back rewind can currently go
+        size_t deltaBytes; //ring bytes taken by records
+        size_t capacity; //ring size
+        size_t stateBytes; //one uncompressed snapshot
+        size_t memoryBytes; //ring, record index and working buffers
+        double lastSnapshotMicros; //save plus encode of the latest snapshot
+        double averageSnapshotMicros;
+        double averageFrameMicros; //snapshot cost spread over the interval
+        double compressionRatio; //uncompressed over encoded, records only
+    };
+
+    RewindBuffer();
+    ~RewindBuffer();
+
+    //allocates the ring; drops any history
+    bool configure(size_t capacity, int interval);
+    //drops the history, the next endFrame takes a fresh base snapshot
+    void reset();
+
+    //the inputs of the frame about to run, then the state after it
+    void recordInput(uint8_t input);
+    void endFrame(const gb::GBState& state);
+
+    //goes back up to frames frames: on return snapshot holds the state to
+    //load and replay the inputs of the frames to run after it to arrive at
+    //the target. Returns the frames actually gone back, 0 if there is
+    //nothing to go back to. Both pointers stay valid until the next call
+    int seek(int frames, const uint8_t*& snapshot, size_t& snapshotSize, const uint8_t*& replay, int& replayFrames);
+
+    Stats getStats() const;
+
+private:
+    struct Record {
+        uint32_t offset; //in the ring
+        uint32_t length; //inputs followed by the encoded delta
+        uint32_t frame; //of the snapshot this record rebuilds
+        uint16_t inputs;
+    };
+
+    uint8_t* ring;
+    size_t capacity;
+    size_t writePosition;
+    size_t usedBytes;
+
+    Record* records;
+    int oldest;
+    int count;
+
+    int interval;
+    uint32_t frame; //frames run since the last reset
+    bool hasLatest;
+    uint32_t latestFrame;
+    uint8_t* latest; //newest snapshot, whole
+    uint8_t* work; //the next snapshot, or the one being rebuilt
+    uint8_t* encoded;
+    size_t stateSize;
+    size_t encodedCapacity;
+
+    uint8_t* pending; //inputs of the frames since latest
+    int pendingCount;
+
+    double lastMicros;
+    double totalMicros;
+    uint32_t snapshotsTaken;
+    uint64_t rawBytes; //uncompressed size of the records held
+    uint64_t heldBytes; //their encoded size
+
+    void snapshot(const gb::GBState& state);
+    bool resize(size_t size);
+    bool store(const uint8_t* delta, size_t length);
+    void dropOldest();
+    void dropNewest();
+    void freeStates();
+
+    static size_t encode(const uint8_t* older, const uint8_t* newer, size_t size, uint8_t* out);
+    static bool apply(uint8_t* data, size_t size, const uint8_t* delta, size_t length);
+};
+
+#endif
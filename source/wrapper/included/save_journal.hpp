@@ -0,0 +1,92 @@
+#ifndef WRAPPER_SAVE_JOURNAL_HPP
+#define WRAPPER_SAVE_JOURNAL_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+#include "../gb/included/state.hpp"
+
+//keeps a battery save file current from a background thread
+//the emulation side hands over the 256 byte sram pages written since the
+//last frame; once writes have been quiet for the debounce time the thread
+//appends them to path.journal as checksummed records, and now and then folds
+//the journal into the save itself (written to path.tmp, then renamed over it)
+//so a crash at any point leaves a loadable base plus a replayable journal
+class SaveJournal {
+public:
+    static constexpr int PAGE_SIZE = gb::CartridgeState::RAM_PAGE_SIZE;
+    static constexpr int DIRTY_WORDS = gb::CartridgeState::RAM_DIRTY_WORDS;
+
+    SaveJournal();
+    ~SaveJournal();
+
+    //writes ram as the new base and starts the thread; debounceMs is how long
+    //writes must pause before they are flushed (never more than 4x that late)
+    bool open(const char* path, const uint8_t* ram, int size, int debounceMs = 500);
+
+    //flushes what is pending, folds the journal into the save and joins
+    void close();
+
+    bool isOpen() const;
+
+    //producer: copies the pages set in dirty (DIRTY_WORDS words) out of ram
+    void submit(const uint8_t* ram, const uint64_t* dirty);
+
+    uint32_t getPagesWritten() const;
+    uint32_t getCompactions() const;
+    bool hasError() const;
+
+    //synchronous whole image save, atomically replacing path
+    static bool writeImage(const char* path, const uint8_t* ram, int size);
+    //loads path (or a finished path.tmp left by a crash) and replays a
+    //journal next to it if that was written against this base (crc in its
+    //header); false when neither holds anything for this size, ram is then
+    //left as it was
+    static bool readImage(const char* path, uint8_t* ram, int size);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static constexpr int RECORD_SIZE = 4 + PAGE_SIZE + 4; //page, data, crc
+    static constexpr int HEADER_SIZE = 16;
+    static constexpr int MAX_PATH = 256;
+
+    std::thread flusher;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<bool> running;
+
+    std::atomic<uint32_t> pagesWritten;
+    std::atomic<uint32_t> compactions;
+    std::atomic<bool> error;
+
+    //guarded by mutex: latest contents of every page handed over
+    uint8_t* staging;
+    uint64_t pending[DIRTY_WORDS];
+    bool anyPending;
+    Clock::time_point firstPending;
+    Clock::time_point lastPending;
+
+    //only touched by the flusher thread while it runs
+    uint8_t* persisted; //base plus everything journaled so far
+    FILE* journal;
+    int journalRecords;
+
+    char basePath[MAX_PATH];
+    int size;
+    std::chrono::milliseconds debounce;
+
+    void run();
+    void flush(const uint64_t* pages);
+    bool compact();
+    bool resetJournal();
+
+    static void journalPath(const char* path, char* out);
+};
+
+#endif
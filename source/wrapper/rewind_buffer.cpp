@@ -0,0 +1,337 @@
+// rewind_buffer.cpp
+#include "included/rewind_buffer.hpp"
+#include "../gb/included/savestate.hpp"
+#include <cstring>
+#include <chrono>
+#include <new>
+
+static inline uint64_t load64(const uint8_t* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint8_t* putVarint(uint8_t* out, size_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static inline bool getVarint(const uint8_t*& in, const uint8_t* end, size_t& value) {
+    value = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        uint8_t byte = *in++;
+        value |= (size_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+//a literal run only ends at this many unchanged bytes, shorter gaps cost
+//more as a new run header than as literal zeros
+static constexpr int MIN_SKIP = 4;
+
+//worst case output of encode beyond the input size
+static constexpr size_t ENCODE_SLACK = 16;
+
+RewindBuffer::RewindBuffer() : ring(nullptr), capacity(0), writePosition(0), usedBytes(0), records(nullptr), oldest(0),
+                               count(0), interval(1), frame(0), hasLatest(false), latestFrame(0), latest(nullptr),
+                               work(nullptr), encoded(nullptr), stateSize(0), encodedCapacity(0), pending(nullptr),
+                               pendingCount(0), lastMicros(0), totalMicros(0), snapshotsTaken(0), rawBytes(0),
+                               heldBytes(0) {
+}
+
+RewindBuffer::~RewindBuffer() {
+    freeStates();
+    delete[] ring;
+    delete[] records;
+    delete[] pending;
+}
+
+bool RewindBuffer::configure(size_t capacity, int interval) {
+    if (capacity == 0 || capacity > UINT32_MAX || interval < 1 || interval > MAX_INTERVAL) return false;
+
+    delete[] ring;
+    delete[] records;
+    delete[] pending;
+    ring = new (std::nothrow) uint8_t[capacity];
+    records = new (std::nothrow) Record[MAX_RECORDS];
+    pending = new (std::nothrow) uint8_t[interval];
+    if (!ring || !records || !pending) {
+        delete[] ring;
+        delete[] records;
+        delete[] pending;
+        ring = nullptr;
+        records = nullptr;
+        pending = nullptr;
+        this->capacity = 0;
+        return false;
+    }
+
+    this->capacity = capacity;
+    this->interval = interval;
+    lastMicros = totalMicros = 0;
+    snapshotsTaken = 0;
+    reset();
+    return true;
+}
+
+void RewindBuffer::reset() {
+    writePosition = 0;
+    usedBytes = 0;
+    oldest = 0;
+    count = 0;
+    rawBytes = heldBytes = 0;
+    frame = 0;
+    hasLatest = false;
+    latestFrame = 0;
+    pendingCount = 0;
+}
+
+void RewindBuffer::freeStates() {
+    delete[] latest;
+    delete[] work;
+    delete[] encoded;
+    latest = work = encoded = nullptr;
+    stateSize = encodedCapacity = 0;
+}
+
+bool RewindBuffer::resize(size_t size) {
+    //deltas only apply between states of one size
+    freeStates();
+    reset();
+
+    latest = new (std::nothrow) uint8_t[size];
+    work = new (std::nothrow) uint8_t[size];
+    encoded = new (std::nothrow) uint8_t[size + ENCODE_SLACK];
+    if (!latest || !work || !encoded) {
+        freeStates();
+        return false;
+    }
+    stateSize = size;
+    encodedCapacity = size + ENCODE_SLACK;
+    return true;
+}
+
+void RewindBuffer::recordInput(uint8_t input) {
+    if (hasLatest && pendingCount < interval) {
+        pending[pendingCount++] = input;
+    }
+}
+
+void RewindBuffer::endFrame(const gb::GBState& state) {
+    if (!ring) return;
+
+    frame++;
+    if (!hasLatest || frame - latestFrame >= (uint32_t)interval) {
+        snapshot(state);
+    }
+}
+
+void RewindBuffer::snapshot(const gb::GBState& state) {
+    auto start = std::chrono::steady_clock::now();
+
+    //the replay after a seek redraws the picture and the audio output is
+    //restarted anyway, the output sections would only fill the ring
+    size_t size = gb::savestate::size(state, false);
+    if (size != stateSize && !resize(size)) return;
+    if (gb::savestate::save(state, work, stateSize, false) != stateSize) return;
+
+    //the previous snapshot becomes a delta against this one
+    if (hasLatest) {
+        size_t length = encode(latest, work, stateSize, encoded);
+        if (store(encoded, length)) {
+            rawBytes += stateSize;
+        }
+    }
+
+    uint8_t* swap = latest;
+    latest = work;
+    work = swap;
+    latestFrame = frame;
+    hasLatest = true;
+    pendingCount = 0;
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    lastMicros = std::chrono::duration<double, std::micro>(elapsed).count();
+    totalMicros += lastMicros;
+    snapshotsTaken++;
+}
+
+bool RewindBuffer::store(const uint8_t* delta, size_t length) {
+    size_t total = pendingCount + length;
+    if (total > capacity) {
+        //a single record larger than the ring, nothing older stays reachable
+        while (count > 0) dropOldest();
+        return false;
+    }
+    if (count == MAX_RECORDS) dropOldest();
+
+    size_t position = writePosition;
+    if (position + total > capacity) {
+        //the tail holds the oldest records, they go before wrapping around
+        while (count > 0 && records[oldest].offset >= position) dropOldest();
+        position = 0;
+    }
+    //from here on the oldest record is the first one ahead of position
+    while (count > 0 && records[oldest].offset < position + total &&
+           position < records[oldest].offset + records[oldest].length) {
+        dropOldest();
+    }
+
+    memcpy(ring + position, pending, pendingCount);
+    memcpy(ring + position + pendingCount, delta, length);
+
+    Record& record = records[(oldest + count) % MAX_RECORDS];
+    record.offset = (uint32_t)position;
+    record.length = (uint32_t)total;
+    record.frame = latestFrame;
+    record.inputs = (uint16_t)pendingCount;
+    count++;
+
+    writePosition = position + total;
+    usedBytes += total;
+    heldBytes += length;
+    return true;
+}
+
+void RewindBuffer::dropOldest() {
+    const Record& record = records[oldest];
+    usedBytes -= record.length;
+    heldBytes -= record.length - record.inputs;
+    rawBytes -= stateSize;
+    oldest = (oldest + 1) % MAX_RECORDS;
+    count--;
+}
+
+void RewindBuffer::dropNewest() {
+    const Record& record = records[(oldest + count - 1) % MAX_RECORDS];
+    usedBytes -= record.length;
+    heldBytes -= record.length - record.inputs;
+    rawBytes -= stateSize;
+    count--;
+
+    if (count > 0) {
+        const Record& newest = records[(oldest + count - 1) % MAX_RECORDS];
+        writePosition = newest.offset + newest.length;
+    } else {
+        writePosition = 0;
+    }
+}
+
+int RewindBuffer::seek(int frames, const uint8_t*& snapshot, size_t& snapshotSize, const uint8_t*& replay,
+                       int& replayFrames) {
+    if (!hasLatest || frames <= 0) return 0;
+
+    uint32_t oldestFrame = count > 0 ? records[oldest].frame : latestFrame;
+    uint32_t target = (uint32_t)frames >= frame - oldestFrame ? oldestFrame : frame - frames;
+    if (target >= frame) return 0;
+
+    //undo deltas newest first until the snapshot is at or before the target;
+    //the history after it is given up, the frames replayed from here log anew
+    if (target < latestFrame) {
+        memcpy(work, latest, stateSize);
+        while (count > 0 && latestFrame > target) {
+            const Record& record = records[(oldest + count - 1) % MAX_RECORDS];
+            const uint8_t* data = ring + record.offset;
+            if (!apply(work, stateSize, data + record.inputs, record.length - record.inputs)) {
+                reset();
+                return 0;
+            }
+            memcpy(pending, data, record.inputs);
+            latestFrame = record.frame;
+            dropNewest();
+        }
+
+        uint8_t* swap = latest;
+        latest = work;
+        work = swap;
+    }
+
+    int back = (int)(frame - target);
+    pendingCount = (int)(target - latestFrame);
+    frame = target;
+
+    snapshot = latest;
+    snapshotSize = stateSize;
+    replay = pending;
+    replayFrames = pendingCount;
+    return back;
+}
+
+RewindBuffer::Stats RewindBuffer::getStats() const {
+    Stats stats;
+
+    stats.snapshots = count + (hasLatest ? 1 : 0);
+    stats.framesAvailable = hasLatest ? frame - (count > 0 ? records[oldest].frame : latestFrame) : 0;
+    stats.deltaBytes = usedBytes;
+    stats.capacity = capacity;
+    stats.stateBytes = stateSize;
+    stats.memoryBytes = capacity + (records ? MAX_RECORDS * sizeof(Record) : 0) + (pending ? interval : 0) +
+                        2 * stateSize + encodedCapacity;
+    stats.lastSnapshotMicros = lastMicros;
+    stats.averageSnapshotMicros = snapshotsTaken > 0 ? totalMicros / snapshotsTaken : 0;
+    stats.averageFrameMicros = stats.averageSnapshotMicros / interval;
+    stats.compressionRatio = heldBytes > 0 ? (double)rawBytes / heldBytes : 0;
+    return stats;
+}
+
+//runs of (unchanged byte count, changed byte count, changed bytes xored);
+//trailing unchanged bytes are implied
+size_t RewindBuffer::encode(const uint8_t* older, const uint8_t* newer, size_t size, uint8_t* out) {
+    uint8_t* o = out;
+    size_t i = 0;
+
+    while (i < size) {
+        size_t start = i;
+        while (i + 8 <= size && load64(older + i) == load64(newer + i)) i += 8;
+        while (i < size && older[i] == newer[i]) i++;
+        if (i == size) break;
+
+        size_t literal = i;
+        size_t end = i;
+        int same = 0;
+        while (i < size && same < MIN_SKIP) {
+            if (older[i] == newer[i]) {
+                same++;
+            } else {
+                same = 0;
+                end = i + 1;
+            }
+            i++;
+        }
+        i = end;
+
+        o = putVarint(o, literal - start);
+        o = putVarint(o, end - literal);
+        for (size_t k = literal; k < end; k++) {
+            *o++ = older[k] ^ newer[k];
+        }
+    }
+    return o - out;
+}
+
+bool RewindBuffer::apply(uint8_t* data, size_t size, const uint8_t* delta, size_t length) {
+    const uint8_t* in = delta;
+    const uint8_t* end = delta + length;
+    size_t position = 0;
+
+    while (in < end) {
+        size_t skip, literal;
+        if (!getVarint(in, end, skip) || !getVarint(in, end, literal)) return false;
+        if (skip > size - position || literal > size - position - skip || literal > (size_t)(end - in)) {
+            return false;
+        }
+
+        position += skip;
+        for (size_t k = 0; k < literal; k++) {
+            data[position + k] ^= in[k];
+        }
+        position += literal;
+        in += literal;
+    }
+    return true;
+}
@@ -0,0 +1,366 @@
+// save_journal.cpp
+#include "included/save_journal.hpp"
+#include "../gb/included/inflate.hpp"
+#include <cstring>
+#include <new>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#define SAVE_JOURNAL_FSYNC 1
+#endif
+
+//journal header: magic, version, sram size, crc of the base it applies to
+static const uint8_t JOURNAL_MAGIC[4] = { 'G', 'B', 'S', 'J' };
+static constexpr uint32_t JOURNAL_VERSION = 2;
+
+static void put32(uint8_t* p, uint32_t value) {
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = value >> 24;
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+//data is only durable once the os has it on disk, not just in the stdio buffer
+static bool syncFile(FILE* file) {
+    if (fflush(file) != 0) return false;
+#ifdef SAVE_JOURNAL_FSYNC
+    if (fsync(fileno(file)) != 0) return false;
+#endif
+    return true;
+}
+
+//a rename is only durable once the directory holding it is on disk too
+static bool syncDirectory(const char* path) {
+#ifdef SAVE_JOURNAL_FSYNC
+    char directory[512];
+    const char* slash = strrchr(path, '/');
+    if (!slash) {
+        strcpy(directory, ".");
+    } else if (slash == path) {
+        strcpy(directory, "/");
+    } else {
+        size_t length = slash - path;
+        if (length >= sizeof(directory)) return false;
+        memcpy(directory, path, length);
+        directory[length] = '\0';
+    }
+
+    int fd = ::open(directory, O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#else
+    (void)path;
+    return true;
+#endif
+}
+
+static int pageCount(int size) {
+    return (size + SaveJournal::PAGE_SIZE - 1) / SaveJournal::PAGE_SIZE;
+}
+
+SaveJournal::SaveJournal() : running(false), pagesWritten(0), compactions(0), error(false), staging(nullptr),
+                             anyPending(false), persisted(nullptr), journal(nullptr), journalRecords(0), size(0),
+                             debounce(0) {
+    basePath[0] = '\0';
+    memset(pending, 0, sizeof(pending));
+}
+
+SaveJournal::~SaveJournal() {
+    close();
+}
+
+bool SaveJournal::open(const char* path, const uint8_t* ram, int size, int debounceMs) {
+    close();
+
+    if (!path || !ram || size <= 0 || size > gb::CartridgeState::MAX_RAM_SIZE) return false;
+    if (strlen(path) + 16 >= sizeof(basePath)) return false;
+
+    strcpy(basePath, path);
+    this->size = size;
+    debounce = std::chrono::milliseconds(debounceMs > 0 ? debounceMs : 0);
+
+    staging = new uint8_t[size];
+    persisted = new uint8_t[size];
+    memcpy(staging, ram, size);
+    memcpy(persisted, ram, size);
+    memset(pending, 0, sizeof(pending));
+    anyPending = false;
+
+    pagesWritten.store(0, std::memory_order_relaxed);
+    compactions.store(0, std::memory_order_relaxed);
+    error.store(false, std::memory_order_relaxed);
+
+    //the ram may hold journal records replayed by readImage, they have to be
+    //in the base before the old journal is dropped; also reports a bad path
+    if (!compact()) {
+        delete[] staging;
+        delete[] persisted;
+        staging = persisted = nullptr;
+        return false;
+    }
+
+    running.store(true, std::memory_order_release);
+    flusher = std::thread(&SaveJournal::run, this);
+    return true;
+}
+
+void SaveJournal::close() {
+    if (flusher.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running.store(false, std::memory_order_release);
+        }
+        wake.notify_one();
+        flusher.join();
+    }
+
+    if (journal) {
+        fclose(journal);
+        journal = nullptr;
+    }
+    delete[] staging;
+    delete[] persisted;
+    staging = persisted = nullptr;
+}
+
+bool SaveJournal::isOpen() const {
+    return running.load(std::memory_order_acquire);
+}
+
+void SaveJournal::submit(const uint8_t* ram, const uint64_t* dirty) {
+    if (!running.load(std::memory_order_acquire)) return;
+
+    int pages = pageCount(size);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int page = 0; page < pages; page++) {
+            if (!(dirty[page >> 6] & (1ull << (page & 63)))) continue;
+
+            int offset = page * PAGE_SIZE;
+            int length = size - offset < PAGE_SIZE ? size - offset : PAGE_SIZE;
+            memcpy(staging + offset, ram + offset, length);
+            pending[page >> 6] |= 1ull << (page & 63);
+        }
+
+        Clock::time_point now = Clock::now();
+        if (!anyPending) firstPending = now;
+        lastPending = now;
+        anyPending = true;
+    }
+    wake.notify_one();
+}
+
+uint32_t SaveJournal::getPagesWritten() const {
+    return pagesWritten.load(std::memory_order_relaxed);
+}
+
+uint32_t SaveJournal::getCompactions() const {
+    return compactions.load(std::memory_order_relaxed);
+}
+
+bool SaveJournal::hasError() const {
+    return error.load(std::memory_order_relaxed);
+}
+
+void SaveJournal::run() {
+    uint64_t pages[DIRTY_WORDS];
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        bool live = running.load(std::memory_order_acquire);
+        if (!anyPending) {
+            if (!live) break;
+            wake.wait(lock);
+            continue;
+        }
+
+        //debounce: wait for a quiet period, but not forever under steady writes
+        Clock::time_point due = lastPending + debounce;
+        Clock::time_point latest = firstPending + debounce * 4;
+        if (latest < due) due = latest;
+        if (live && Clock::now() < due) {
+            wake.wait_until(lock, due);
+            continue;
+        }
+
+        memcpy(pages, pending, sizeof(pages));
+        memset(pending, 0, sizeof(pending));
+        anyPending = false;
+        for (int page = 0; page < pageCount(size); page++) {
+            if (pages[page >> 6] & (1ull << (page & 63))) {
+                int offset = page * PAGE_SIZE;
+                int length = size - offset < PAGE_SIZE ? size - offset : PAGE_SIZE;
+                memcpy(persisted + offset, staging + offset, length);
+            }
+        }
+
+        //the file work happens without the lock, submit never waits on disk
+        lock.unlock();
+        flush(pages);
+        lock.lock();
+    }
+
+    lock.unlock();
+    if (journalRecords > 0) {
+        compact();
+    }
+}
+
+void SaveJournal::flush(const uint64_t* pages) {
+    if (!journal) return;
+
+    uint8_t record[RECORD_SIZE];
+    int written = 0;
+    for (int page = 0; page < pageCount(size); page++) {
+        if (!(pages[page >> 6] & (1ull << (page & 63)))) continue;
+
+        int offset = page * PAGE_SIZE;
+        int length = size - offset < PAGE_SIZE ? size - offset : PAGE_SIZE;
+        memset(record, 0, sizeof(record));
+        put32(record, page);
+        memcpy(record + 4, persisted + offset, length);
+        put32(record + 4 + PAGE_SIZE, gb::inflate::crc32(record, 4 + PAGE_SIZE));
+
+        if (fwrite(record, 1, sizeof(record), journal) != sizeof(record)) {
+            error.store(true, std::memory_order_relaxed);
+            return;
+        }
+        written++;
+    }
+
+    if (!syncFile(journal)) {
+        error.store(true, std::memory_order_relaxed);
+        return;
+    }
+    journalRecords += written;
+    pagesWritten.fetch_add(written, std::memory_order_relaxed);
+
+    //once replaying would cost more than a full write, fold it in
+    if (journalRecords * PAGE_SIZE >= size) {
+        compact();
+    }
+}
+
+bool SaveJournal::compact() {
+    //base first: until the rename lands the old base plus journal stays valid
+    if (!writeImage(basePath, persisted, size)) {
+        error.store(true, std::memory_order_relaxed);
+        return false;
+    }
+    if (!resetJournal()) {
+        error.store(true, std::memory_order_relaxed);
+        return false;
+    }
+    compactions.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool SaveJournal::resetJournal() {
+    char path[MAX_PATH + 16];
+    journalPath(basePath, path);
+
+    if (journal) fclose(journal);
+    journal = fopen(path, "wb");
+    journalRecords = 0;
+    if (!journal) return false;
+
+    uint8_t header[HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, JOURNAL_MAGIC, 4);
+    put32(header + 4, JOURNAL_VERSION);
+    put32(header + 8, size);
+    put32(header + 12, gb::inflate::crc32(persisted, size));
+
+    return fwrite(header, 1, sizeof(header), journal) == sizeof(header) && syncFile(journal);
+}
+
+void SaveJournal::journalPath(const char* path, char* out) {
+    snprintf(out, MAX_PATH + 16, "%s.journal", path);
+}
+
+bool SaveJournal::writeImage(const char* path, const uint8_t* ram, int size) {
+    char tmpPath[MAX_PATH + 16];
+    if (!path || snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path) >= (int)sizeof(tmpPath)) return false;
+
+    FILE* file = fopen(tmpPath, "wb");
+    if (!file) return false;
+
+    bool ok = fwrite(ram, 1, size, file) == (size_t)size && syncFile(file);
+    fclose(file);
+    if (!ok) {
+        remove(tmpPath);
+        return false;
+    }
+
+    //atomic on posix; file systems that refuse to replace (fat) need the old
+    //one gone first, readImage then picks the finished .tmp up
+    if (rename(tmpPath, path) != 0) {
+        remove(path);
+        if (rename(tmpPath, path) != 0) return false;
+    }
+    //callers drop the old journal next, which must not reach the disk first
+    return syncDirectory(path);
+}
+
+bool SaveJournal::readImage(const char* path, uint8_t* ram, int size) {
+    char other[MAX_PATH + 16];
+    bool found = false;
+
+    //everything is assembled in a scratch copy, ram only changes on success;
+    //without a base file the journal applies to the ram as it is
+    uint8_t* image = new (std::nothrow) uint8_t[size];
+    if (!image) return false;
+    memcpy(image, ram, size);
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        snprintf(other, sizeof(other), "%s.tmp", path);
+        file = fopen(other, "rb");
+    }
+    if (file) {
+        //larger files (rtc data appended by other emulators) are fine
+        found = fread(image, 1, size, file) == (size_t)size;
+        fclose(file);
+        if (!found) memcpy(image, ram, size);
+    }
+
+    journalPath(path, other);
+    file = fopen(other, "rb");
+    if (!file) {
+        if (found) memcpy(ram, image, size);
+        delete[] image;
+        return found;
+    }
+
+    //a journal written against another base (the new base landed, the
+    //journal reset did not) would put stale pages over newer ones
+    uint8_t header[HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), file) == sizeof(header) && memcmp(header, JOURNAL_MAGIC, 4) == 0 &&
+        get32(header + 4) == JOURNAL_VERSION && get32(header + 8) == (uint32_t)size &&
+        get32(header + 12) == gb::inflate::crc32(image, size)) {
+        //records apply in order; a torn tail record fails its crc and ends the replay
+        uint8_t record[RECORD_SIZE];
+        while (fread(record, 1, sizeof(record), file) == sizeof(record)) {
+            uint32_t page = get32(record);
+            if (get32(record + 4 + PAGE_SIZE) != gb::inflate::crc32(record, 4 + PAGE_SIZE)) break;
+            if (page >= (uint32_t)pageCount(size)) break;
+
+            int offset = page * PAGE_SIZE;
+            int length = size - offset < PAGE_SIZE ? size - offset : PAGE_SIZE;
+            memcpy(image + offset, record + 4, length);
+            found = true;
+        }
+    }
+    fclose(file);
+
+    if (found) memcpy(ram, image, size);
+    delete[] image;
+    return found;
+}